@@ -17,12 +17,17 @@ typedef struct {
     uint8_t had_error;
     uint8_t panic;
     scanner *s;
+    object_struct **structs; // Structs declared so far in this compile unit, used to resolve field accesses to slots
+    uint32_t struct_count;
+    uint32_t struct_capacity;
 } parser;
 
 typedef struct {
     token name;
     long depth;
     uint8_t is_captured;
+    long scratch_site; // Offset of the OP_MAKE_ARRAY/OP_CLOSURE that initialised this local (-1 if none)
+    uint8_t escapes; // Set once the local is used in a way that could leak its value out of the scope
 } local;
 
 typedef struct {
@@ -74,6 +79,9 @@ typedef struct compiler {
     uint32_t *module_export_names;
     uint32_t module_export_count;
     uint32_t module_export_capacity;
+    long last_array_site; // Offset of the most recently emitted OP_MAKE_ARRAY
+    long last_call_site; // Offset of the values-wanted operand of the most recently emitted call, always its last byte
+    long last_jump_target; // Offset the most recently patched jump lands on
 } compiler;
 
 typedef enum {
@@ -145,6 +153,9 @@ static void init_compiler(parser *p, compiler *c, VM *vm, function_type type, to
     c->module_export_names = NULL;
     c->module_export_count = 0;
     c->module_export_capacity = 0;
+    c->last_array_site = -1;
+    c->last_call_site = -1;
+    c->last_jump_target = -1;
     if (make_function) c->function = new_function(vm);
     token t; // This section of adding a sentinel local gets a bit more complicated because we have to allocate the locals array
     t.start = "";
@@ -183,6 +194,9 @@ static void init_parser(parser *p, scanner *s) {
     p->s = s;
     p->had_error = 0;
     p->panic = 0;
+    p->structs = NULL;
+    p->struct_count = 0;
+    p->struct_capacity = 0;
 }
 
 static void error_at(parser *p, token *t, const char *message) {
@@ -301,6 +315,20 @@ static void emit_return(parser *p, compiler *c) {
     emit_byte(p, c, OP_RETURN);
 }
 
+static void emit_values_wanted(parser *p, compiler *c) { // One value unless patched once we know the call is all of a destructuring, return or statement
+    emit_byte(p, c, 1);
+    c->last_call_site = (long) current_seg(c)->len - 1;
+}
+
+static uint8_t ends_in_call(compiler *c) { // Whether the value just compiled can only have come from the last call emitted
+    long len = (long) current_seg(c)->len;
+    return c->last_call_site != -1 && c->last_call_site == len - 1 && c->last_jump_target != len;
+}
+
+static void patch_values_wanted(compiler *c, uint8_t wanted) {
+    current_seg(c)->bytecode[c->last_call_site] = wanted;
+}
+
 static void emit_constant(parser *p, compiler *c, value v) {
     uint32_t constant = add_constant(current_seg(c), v);
     if (!emit_variable_length_instruction(p, c, OP_CONSTANT, constant)) {
@@ -319,6 +347,7 @@ static void patch_jump(parser *p, compiler *c, size_t offset) {
     current_seg(c)->bytecode[offset+2] = (uint8_t) (jump >> 16);
     current_seg(c)->bytecode[offset+3] = (uint8_t) (jump >> 8);
     current_seg(c)->bytecode[offset+4] = (uint8_t) jump;
+    c->last_jump_target = (long) current_seg(c)->len;
 }
 
 static void patch_breaks(parser *p, compiler *c) {
@@ -340,6 +369,10 @@ static void exit_loop_scope(parser *p, compiler *c) {
     long to_pop = 0;
     long local_count = c->local_count;
     while (local_count > 0 && c->locals[local_count-1].depth > l->scope_depth) {
+        if (c->locals[local_count-1].scratch_site != -1) {
+            // We don't know yet whether this local escapes later in its scope, but releasing a heap object is a no-op so it's always safe to emit
+            emit_variable_length_instruction(p, c, OP_RELEASE_SCRATCH, (uint32_t) (local_count-1));
+        }
         to_pop++;
         local_count--;
     }
@@ -381,7 +414,20 @@ static void emit_module_return(parser *p, compiler *c) {
     emit_byte(p, c, OP_RETURN);
 }
 
+static uint8_t is_frame_local(local *l) {
+    return l->scratch_site != -1 && !l->escapes && !l->is_captured;
+}
+
+static void make_frame_local(compiler *c, local *l) {
+    // The local never escaped its scope, so rewrite its allocation to use frame-local storage
+    uint8_t *op = &current_seg(c)->bytecode[l->scratch_site];
+    *op = *op == OP_MAKE_ARRAY ? OP_MAKE_ARRAY_SCRATCH : OP_CLOSURE_SCRATCH;
+}
+
 static object_function *end_compiler(parser *p, compiler *c) {
+    for (long i = 0; i < c->local_count; i++) { // Locals still in scope at the end of a function are released when its frame returns
+        if (c->locals[i].depth > 0 && is_frame_local(&c->locals[i])) make_frame_local(c, &c->locals[i]);
+    }
     if (c->type == TYPE_MODULE) {
         emit_module_return(p, c);
     } else {
@@ -404,6 +450,13 @@ static void begin_scope(compiler *c) {
 static void end_scope(parser *p, compiler *c) {
     c->scope_depth--;
 
+    for (long i = c->local_count - 1; i >= 0 && c->locals[i].depth > c->scope_depth; i--) {
+        if (is_frame_local(&c->locals[i])) {
+            make_frame_local(c, &c->locals[i]);
+            emit_variable_length_instruction(p, c, OP_RELEASE_SCRATCH, (uint32_t) i);
+        }
+    }
+
     while (c->local_count > 0 && c->locals[c->local_count-1].depth > c->scope_depth) {
         if (c->locals[c->local_count-1].is_captured) {
             emit_byte(p, c, OP_CLOSE_UPVALUE);
@@ -450,14 +503,43 @@ static void binary(parser *p, compiler *c, VM *vm, uint8_t can_assign) {
 static void call(parser *p, compiler *c, VM *vm, uint8_t can_assign) {
     uint8_t argc = argument_list(p, c, vm);
     emit_2_bytes(p, c, OP_CALL, argc);
+    emit_values_wanted(p, c);
+}
+
+static long resolve_struct_field(parser *p, token *name) {
+    // We don't know the type of the object being accessed, so guess the slot from the first struct with a field of this name
+    for (uint32_t i = 0; i < p->struct_count; i++) {
+        object_struct *type = p->structs[i];
+        for (uint32_t j = 0; j < type->field_count; j++) { // struct_declaration caps fields at 255, so any slot fits the 1-byte operand
+            if (type->field_names[j]->length == name->length && memcmp(type->field_names[j]->chars, name->start, name->length) == 0) return (long) j;
+        }
+    }
+    return -1;
+}
+
+static void emit_field_instruction(parser *p, compiler *c, opcode op, uint8_t slot, uint32_t name) {
+    if (name <= UINT8_MAX) {
+        uint8_t bytes[3] = {op, slot, name};
+        emit_bytes(p, c, bytes, 3);
+    }
+    else {
+        uint8_t bytes[6] = {OP_LONG, op, slot, name >> 16, name >> 8, name};
+        emit_bytes(p, c, bytes, 6);
+    }
 }
 
 static void dot(parser *p, compiler *c, VM *vm, uint8_t can_assign) {
     consume(p, TOKEN_IDENTIFIER, "Expect identifier after '.'.");
     uint32_t property_name = identifier_constant(p, c, vm, &p->prev);
+    long field = resolve_struct_field(p, &p->prev);
 
     uint8_t assigned = 0;
-    if (can_assign) {
+    if (can_assign && field != -1 && match(p, TOKEN_EQUAL)) {
+        expression(p, c, vm);
+        emit_field_instruction(p, c, OP_SET_FIELD, (uint8_t) field, property_name);
+        assigned = 1;
+    }
+    else if (can_assign) {
         if (!check(p, TOKEN_EQUAL)) {
             assigned |= handle_assignment(p, c, vm, 0, property_name, OP_GET_PROPERTY_KEEP_REF, OP_SET_PROPERTY);
         }
@@ -470,6 +552,12 @@ static void dot(parser *p, compiler *c, VM *vm, uint8_t can_assign) {
             uint8_t argc = argument_list(p, c, vm);
             emit_variable_length_instruction(p, c, OP_INVOKE, property_name);
             emit_byte(p, c, argc);
+            uint8_t cache[7] = {0}; // Empty inline cache, filled in by the VM with the receiver's class and slot for this method
+            emit_bytes(p, c, cache, 7);
+            emit_values_wanted(p, c);
+        }
+        else if (field != -1) {
+            emit_field_instruction(p, c, OP_GET_FIELD, (uint8_t) field, property_name);
         }
         else {
             emit_variable_length_instruction(p, c, OP_GET_PROPERTY, property_name);
@@ -531,7 +619,7 @@ static void number(parser *p, compiler *c, VM *vm, uint8_t can_assign) {
     emit_constant(p, c, NUMBER_VAL(num));
 }
 
-static void string(parser *p, compiler *c, VM *vm, uint8_t can_assign) {
+static object_string *string_literal(parser *p, VM *vm) {
     const char *src = p->prev.start + 1;
     size_t src_len = p->prev.length - 2;
     char *buf = malloc(src_len + 1);
@@ -552,8 +640,13 @@ static void string(parser *p, compiler *c, VM *vm, uint8_t can_assign) {
             buf[out++] = src[i];
         }
     }
-    emit_constant(p, c, OBJ_VAL(copy_string(vm, buf, out)));
+    object_string *result = copy_string(vm, buf, out);
     free(buf);
+    return result;
+}
+
+static void string(parser *p, compiler *c, VM *vm, uint8_t can_assign) {
+    emit_constant(p, c, OBJ_VAL(string_literal(p, vm)));
 }
 
 static void assign_with_op(parser *p, compiler *c, VM *vm, uint8_t var_or_arr, uint32_t arg, opcode get_op, opcode set_op, opcode op, uint8_t can_eval_expr) {
@@ -665,6 +758,9 @@ static void named_variable(parser *p, compiler *c, VM *vm, token name, uint8_t c
     if (!assigned) {
         emit_variable_length_instruction(p, c, get_op, arg);
     }
+    if (get_op == OP_GET_LOCAL && (assigned || !(check(p, TOKEN_LEFT_SQR) || check(p, TOKEN_LEFT_PAREN)))) {
+        c->locals[arg].escapes = 1; // Only indexing and calling are known not to leak the value
+    }
 }
 
 static void variable(parser *p, compiler *c, VM *vm, uint8_t can_assign) {
@@ -690,7 +786,8 @@ static void super_(parser *p, compiler *c, VM *vm, uint8_t can_assign) {
     uint32_t name = identifier_constant(p, c, vm, &p->prev);
 
     named_variable(p, c, vm, synthetic_token("this"), 0);
-    if (match(p, TOKEN_LEFT_PAREN)) {
+    uint8_t invoking = match(p, TOKEN_LEFT_PAREN);
+    if (invoking) {
         uint8_t argc = argument_list(p, c, vm);
         named_variable(p, c, vm, synthetic_token("super"), 0);
         emit_variable_length_instruction(p, c, OP_INVOKE_SUPER, name);
@@ -699,6 +796,9 @@ static void super_(parser *p, compiler *c, VM *vm, uint8_t can_assign) {
         named_variable(p, c, vm, synthetic_token("super"), 0);
         emit_variable_length_instruction(p, c, OP_GET_SUPER, name);
     }
+    uint8_t cache[7] = {0}; // Empty inline cache, filled in by the VM with the superclass' slot for this method
+    emit_bytes(p, c, cache, 7);
+    if (invoking) emit_values_wanted(p, c);
 }
 
 static void this_(parser *p, compiler *c, VM *vm, uint8_t can_assign) {
@@ -730,6 +830,7 @@ static void expression(parser *p, compiler *c, VM *vm) {
 
 static void expression_statement(parser *p, compiler *c, VM *vm) {
     expression(p, c, vm);
+    if (ends_in_call(c)) patch_values_wanted(c, RETURNS_ANY); // Popped straight away, so a multiple return is fine
     consume(p, TOKEN_SEMICOLON, "Expect ';' after expression.");
     emit_byte(p, c, OP_POP);
 }
@@ -752,6 +853,145 @@ static void if_statement(parser *p, compiler *c, VM *vm) {
     patch_jump(p, c, else_jump);
 }
 
+static value case_label(parser *p, VM *vm) {
+    if (match(p, TOKEN_NUMBER)) return NUMBER_VAL(strtod(p->prev.start, NULL));
+    if (match(p, TOKEN_MINUS)) {
+        consume(p, TOKEN_NUMBER, "Expect number after '-' in case label.");
+        return NUMBER_VAL(-strtod(p->prev.start, NULL));
+    }
+    if (match(p, TOKEN_STRING)) return OBJ_VAL(string_literal(p, vm));
+    if (match(p, TOKEN_TRUE)) return BOOL_VAL(1);
+    if (match(p, TOKEN_FALSE)) return BOOL_VAL(0);
+    if (match(p, TOKEN_NULL)) return NULL_VAL;
+    if (match(p, TOKEN_IDENTIFIER)) { // Error type names are globals, but in case labels they always mean the builtin types
+        const char *error_strings[8] = {"NameError", "TypeError", "ValueError", "ImportError", "ArgumentError", "RecursionError", "MemoryError", "IndexError"};
+        for (uint8_t i = 0; i < 8; i++) {
+            if (p->prev.length == strlen(error_strings[i]) && memcmp(p->prev.start, error_strings[i], p->prev.length) == 0) return ERROR_TYPE_VAL(i);
+        }
+    }
+    else advance(p);
+    error(p, "Case labels must be constants.");
+    return NULL_VAL;
+}
+
+static int compare_numeric_cases(const void *a, const void *b) {
+    double x = AS_NUMBER(((switch_case*) a)->key);
+    double y = AS_NUMBER(((switch_case*) b)->key);
+    return (x > y) - (x < y);
+}
+
+static void build_switch_table(switch_table *t, switch_case *cases, uint32_t count) {
+    uint8_t all_numbers = 1, all_integers = 1, all_strings = 1, all_errors = 1;
+    double min = 0, max = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        value key = cases[i].key;
+        all_numbers &= IS_NUMBER(key);
+        all_strings &= IS_STRING(key);
+        all_errors &= IS_ERROR_TYPE(key);
+        if (!IS_NUMBER(key)) continue;
+        double d = AS_NUMBER(key);
+        all_integers &= d > -UINT48_MAX && d < UINT48_MAX && d == (double) (long) d; // Range check first so the cast is defined
+        if (i == 0 || d < min) min = d;
+        if (i == 0 || d > max) max = d;
+    }
+
+    if (count > 0 && all_numbers && all_integers && max - min < 4.0 * count) { // Dense enough that a direct index is worth the holes
+        t->kind = SWITCH_DENSE;
+        t->dense_min = (long) min;
+        t->dense_len = (uint32_t) (max - min) + 1;
+        t->dense_targets = GROW_ARRAY(NULL, size_t, NULL, 0, t->dense_len);
+        for (uint32_t i = 0; i < t->dense_len; i++) t->dense_targets[i] = t->default_target;
+        for (uint32_t i = 0; i < count; i++) t->dense_targets[(long) AS_NUMBER(cases[i].key) - t->dense_min] = cases[i].target;
+    }
+    else if (count > 0 && all_errors) {
+        t->kind = SWITCH_ERROR;
+        t->dense_len = INDEX_ERROR + 1;
+        t->dense_targets = GROW_ARRAY(NULL, size_t, NULL, 0, t->dense_len);
+        for (uint32_t i = 0; i < t->dense_len; i++) t->dense_targets[i] = t->default_target;
+        for (uint32_t i = 0; i < count; i++) t->dense_targets[AS_ERROR_TYPE(cases[i].key)] = cases[i].target;
+    }
+    else if (count > 0 && all_strings) {
+        t->kind = SWITCH_STRING;
+        t->case_capacity = 8;
+        while (t->case_capacity < count * 2) t->case_capacity *= 2; // Keep the load factor at most 0.5 so probes stay short
+        t->cases = GROW_ARRAY(NULL, switch_case, NULL, 0, t->case_capacity);
+        for (uint32_t i = 0; i < t->case_capacity; i++) t->cases[i].key = NULL_VAL;
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t index = string_hash(AS_STRING(cases[i].key)) & (t->case_capacity - 1);
+            while (!IS_NULL(t->cases[index].key)) index = (index + 1) & (t->case_capacity - 1);
+            t->cases[index] = cases[i];
+        }
+    }
+    else {
+        t->kind = all_numbers ? SWITCH_SPARSE : SWITCH_GENERIC;
+        t->case_capacity = count;
+        t->cases = GROW_ARRAY(NULL, switch_case, NULL, 0, count);
+        memcpy(t->cases, cases, count * sizeof(switch_case));
+        if (all_numbers) qsort(t->cases, count, sizeof(switch_case), compare_numeric_cases);
+    }
+}
+
+static void switch_statement(parser *p, compiler *c, VM *vm) {
+    expression(p, c, vm);
+    consume(p, TOKEN_LEFT_BRACE, "Expect '{' after switch value.");
+    uint32_t table = add_switch_table(current_seg(c)); // Filled in once we know where each case lands
+    uint8_t bytes[4] = {OP_SWITCH, table >> 16, table >> 8, table};
+    emit_bytes(p, c, bytes, 4);
+    if (table > UINT24_MAX) error(p, "Too many switch statements in one function.");
+
+    switch_case *cases = NULL;
+    uint32_t case_count = 0, case_capacity = 0;
+    size_t *exit_jumps = NULL;
+    uint32_t exit_count = 0, exit_capacity = 0;
+    long default_target = -1;
+
+    while (!check(p, TOKEN_RIGHT_BRACE) && !check(p, TOKEN_EOF)) {
+        size_t target = current_seg(c)->len;
+        if (match(p, TOKEN_CASE)) {
+            do {
+                value key = case_label(p, vm);
+                for (uint32_t i = 0; i < case_count; i++) {
+                    if (value_equality(cases[i].key, key)) error(p, "Duplicate case in switch statement.");
+                }
+                if (case_count >= case_capacity) {
+                    uint32_t oldc = case_capacity;
+                    case_capacity = GROW_CAPACITY(oldc);
+                    cases = GROW_ARRAY(NULL, switch_case, cases, oldc, case_capacity);
+                }
+                cases[case_count].key = key;
+                cases[case_count++].target = target;
+                if (IS_STRING(key)) make_constant(p, c, key); // Keeps the string reachable for the gc
+            } while (match(p, TOKEN_COMMA));
+        }
+        else if (match(p, TOKEN_DEFAULT)) {
+            if (default_target != -1) error(p, "Can't have more than one default in a switch statement.");
+            default_target = (long) target;
+        }
+        else {
+            error_at_current(p, "Expect 'case' or 'default' in switch statement.");
+            break;
+        }
+        consume(p, TOKEN_THEN, "Expect 'then' after case.");
+        begin_scope(c);
+        statement(p, c, vm);
+        end_scope(p, c);
+        if (exit_count >= exit_capacity) { // Cases don't fall through, so every arm jumps out of the switch
+            uint32_t oldc = exit_capacity;
+            exit_capacity = GROW_CAPACITY(oldc);
+            exit_jumps = GROW_ARRAY(NULL, size_t, exit_jumps, oldc, exit_capacity);
+        }
+        exit_jumps[exit_count++] = emit_jump(p, c, OP_JUMP);
+    }
+    consume(p, TOKEN_RIGHT_BRACE, "Expect '}' after switch statement.");
+
+    for (uint32_t i = 0; i < exit_count; i++) patch_jump(p, c, exit_jumps[i]);
+    switch_table *t = &current_seg(c)->switches[table];
+    t->default_target = default_target == -1 ? current_seg(c)->len : (size_t) default_target;
+    build_switch_table(t, cases, case_count);
+    FREE_ARRAY(NULL, switch_case, cases, case_capacity);
+    FREE_ARRAY(NULL, size_t, exit_jumps, exit_capacity);
+}
+
 static void while_statement(parser *p, compiler *c, VM *vm) {
     size_t loop_start = current_seg(c)->len;
     push_loop_stack(c, loop_start, c->scope_depth, 0);
@@ -824,6 +1064,7 @@ static void array_dec(parser *p, compiler *c, VM *vm, uint8_t can_assign) {
     }
     consume(p, TOKEN_RIGHT_SQR, "Expect ']' after array.");
     emit_constant(p, c, NUMBER_VAL((double) nmeb));
+    c->last_array_site = current_seg(c)->len;
     emit_byte(p, c, OP_MAKE_ARRAY);
 }
 
@@ -854,7 +1095,7 @@ static void block(parser *p, compiler *c, VM *vm) {
     consume(p, TOKEN_RIGHT_BRACE, "Expect '}' after block.");
 }
 
-static void function(parser *p, compiler *c, VM *vm, function_type type) {
+static size_t function(parser *p, compiler *c, VM *vm, function_type type) { // Returns the offset of the emitted OP_CLOSURE
     compiler function_compiler;
     init_compiler(p, &function_compiler, vm, type, &p->prev, 1);
     function_compiler.enclosing = c;
@@ -877,6 +1118,7 @@ static void function(parser *p, compiler *c, VM *vm, function_type type) {
     block(p, &function_compiler, vm);
     object_function *function = end_compiler(p, &function_compiler);
     uint32_t constant = make_constant(p, c, OBJ_VAL(function));
+    size_t closure_site = current_seg(c)->len;
     uint8_t bytes[4] = {OP_CLOSURE, constant >> 16, constant >> 8, constant};
     emit_bytes(p, c, bytes, 4);
     for (uint32_t i = 0; i < function->upvalue_count; i++) {
@@ -885,6 +1127,7 @@ static void function(parser *p, compiler *c, VM *vm, function_type type) {
         emit_bytes(p, c, bytes, 4);
     }
     destroy_compiler(&function_compiler, vm);
+    return closure_site;
 }
 
 static void method(parser *p, compiler *c, VM *vm) {
@@ -935,17 +1178,52 @@ static void class_declaration(parser *p, compiler *c, VM *vm) {
         method(p, c, vm);
     }
     consume(p, TOKEN_RIGHT_BRACE, "Expect '}' after class body.");
-    emit_byte(p, c, OP_POP);
+    emit_byte(p, c, OP_SEAL_CLASS);
 
     if (class_c.has_superclass) end_scope(p, c);
 
     c->current_class = c->current_class->enclosing;
 }
 
+static void struct_declaration(parser *p, compiler *c, VM *vm) {
+    uint32_t global = parse_variable(p, c, vm, "Expect struct name.");
+    object_string *name = copy_string(vm, p->prev.start, p->prev.length);
+    consume(p, TOKEN_LEFT_BRACE, "Expect '{' before struct fields.");
+    object_string *fields[UINT8_MAX];
+    uint32_t field_count = 0;
+    if (!check(p, TOKEN_RIGHT_BRACE)) {
+        do {
+            consume(p, TOKEN_IDENTIFIER, "Expect field name.");
+            if (field_count == UINT8_MAX) {
+                error(p, "Can't have more than 255 fields in a struct.");
+                break;
+            }
+            object_string *field = copy_string(vm, p->prev.start, p->prev.length);
+            for (uint32_t i = 0; i < field_count; i++) {
+                if (fields[i] == field) error(p, "Already a field with this name in this struct.");
+            }
+            fields[field_count++] = field;
+        } while (match(p, TOKEN_COMMA));
+    }
+    consume(p, TOKEN_RIGHT_BRACE, "Expect '}' after struct fields.");
+
+    // The layout is fixed, so the struct itself can be built now and loaded as a constant
+    object_struct *type = new_struct(vm, name, fields, field_count);
+    if (p->struct_count >= p->struct_capacity) {
+        size_t oldc = p->struct_capacity;
+        p->struct_capacity = GROW_CAPACITY(oldc);
+        p->structs = GROW_ARRAY(NULL, object_struct*, p->structs, oldc, p->struct_capacity);
+    }
+    p->structs[p->struct_count++] = type;
+    emit_constant(p, c, OBJ_VAL(type));
+    define_variable(p, c, global);
+}
+
 static void function_declaration(parser *p, compiler *c, VM *vm) {
     uint32_t global = parse_variable(p, c, vm, "Expect function name.");
     mark_initialised(c);
-    function(p, c, vm, TYPE_FUNCTION);
+    size_t closure_site = function(p, c, vm, TYPE_FUNCTION);
+    if (c->scope_depth > 0) c->locals[c->local_count-1].scratch_site = (long) closure_site; // Candidate for frame-local storage
     define_variable(p, c, global);
 }
 
@@ -996,11 +1274,53 @@ static void or_(parser *p, compiler *c, VM *vm, uint8_t can_assign) {
     patch_jump(p, c, else_jump);
 }
 
+static void multi_var_declaration(parser *p, compiler *c, VM *vm, uint32_t first) {
+    uint32_t names[UINT8_MAX];
+    uint16_t count = 1;
+    names[0] = first;
+    while (match(p, TOKEN_COMMA)) {
+        if (count == UINT8_MAX - 1) { // The last values-wanted operand is RETURNS_FORWARD
+            error(p, "Can't declare more than 254 variables at once.");
+            break;
+        }
+        names[count++] = parse_variable(p, c, vm, "Expect variable name.");
+    }
+    if (match(p, TOKEN_EQUAL)) {
+        expression(p, c, vm);
+        if (ends_in_call(c)) patch_values_wanted(c, (uint8_t) count); // The callee checks it returns exactly this many
+        else error(p, "Can only unpack the values returned by a call.");
+    }
+    else {
+        for (uint16_t i = 0; i < count; i++) emit_byte(p, c, OP_NULL);
+    }
+    consume(p, TOKEN_SEMICOLON, "Expect ';' after variable declaration,");
+
+    if (c->scope_depth > 0 || c->type == TYPE_MODULE) { // Values are already in the right slots, they just need marking as initialised
+        for (uint16_t i = 0; i < count; i++) {
+            uint32_t slot = (uint32_t) (c->local_count - count + i);
+            c->locals[slot].depth = c->scope_depth;
+            if (c->scope_depth == 0) record_module_export(c, slot, names[i]);
+        }
+    }
+    else {
+        for (uint16_t i = count; i > 0; i--) { // OP_DEFINE_GLOBAL pops, so define from the last value back
+            emit_variable_length_instruction(p, c, OP_DEFINE_GLOBAL, names[i-1]);
+        }
+    }
+}
+
 static void var_declaration(parser *p, compiler *c, VM *vm) {
     uint32_t global = parse_variable(p, c, vm, "Expect variable name.");
+    if (check(p, TOKEN_COMMA)) {
+        multi_var_declaration(p, c, vm, global);
+        return;
+    }
 
     if (match(p, TOKEN_EQUAL)) {
         expression(p, c, vm);
+        if (c->scope_depth > 0 && c->last_array_site != -1 && (size_t) c->last_array_site == current_seg(c)->len - 1) {
+            c->locals[c->local_count-1].scratch_site = c->last_array_site; // Initialised by an array literal - candidate for frame-local storage
+        }
     } else {
         emit_byte(p, c, OP_NULL);
     }
@@ -1071,7 +1391,7 @@ static void import_statement(parser *p, compiler *c, VM *vm) {
 static void print_statement(parser *p, compiler *c, VM *vm) {
     expression(p, c, vm);
     consume(p, TOKEN_SEMICOLON, "Expect ';' after value.");
-    emit_2_bytes(p, c, OP_CONV_TYPE, TYPEOF_STRING);
+    emit_byte(p, c, OP_STR_OVERRIDE); // Rather than converting to a string, which OP_PRINT would only copy out again
     emit_byte(p, c, OP_PRINT);
 }
 
@@ -1087,8 +1407,19 @@ static void return_statement(parser *p, compiler *c, VM *vm) {
             error(p, "Can't return a value from an initialiser.");
         }
         expression(p, c, vm);
+        uint16_t count = 1;
+        while (match(p, TOKEN_COMMA)) { // Extra values are left on the stack for the caller rather than packed into an array
+            if (count == UINT8_MAX) error(p, "Can't return more than 255 values.");
+            expression(p, c, vm);
+            count++;
+        }
         consume(p, TOKEN_SEMICOLON, "Expect ';' after return value.");
-        emit_byte(p, c, OP_RETURN);
+        if (count > 1) emit_2_bytes(p, c, OP_RETURN_MULTI, (uint8_t) count);
+        else if (ends_in_call(c)) { // Passes on however many values the call returns, checked against what our own caller wants
+            patch_values_wanted(c, RETURNS_FORWARD);
+            emit_2_bytes(p, c, OP_RETURN_MULTI, 0);
+        }
+        else emit_byte(p, c, OP_RETURN);
     }
 }
 
@@ -1164,6 +1495,8 @@ static void synchronise(parser *p) {
         if (p->prev.type == TOKEN_SEMICOLON) return;
         switch (p->current.type) {
             case TOKEN_CLASS:
+            case TOKEN_STRUCT:
+            case TOKEN_SWITCH:
             case TOKEN_FUNCTION:
             case TOKEN_LET:
             case TOKEN_FOR:
@@ -1182,6 +1515,9 @@ static void declaration(parser *p, compiler *c, VM *vm) {
     if (match(p, TOKEN_CLASS)) {
         class_declaration(p, c, vm);
     }
+    else if (match(p, TOKEN_STRUCT)) {
+        struct_declaration(p, c, vm);
+    }
     else if (match(p, TOKEN_FUNCTION)) {
         function_declaration(p, c, vm);
     }
@@ -1232,6 +1568,9 @@ static void statement(parser *p, compiler *c, VM *vm) {
     else if (match(p, TOKEN_TRY)) {
         try_statement(p, c, vm);
     }
+    else if (match(p, TOKEN_SWITCH)) {
+        switch_statement(p, c, vm);
+    }
     else if (match(p, TOKEN_RAISE)) {
         raise_statement(p, c, vm);
     }
@@ -1282,6 +1621,10 @@ parse_rule rules[] = {
     [TOKEN_SUPER] = {super_, NULL, PREC_NONE},
     [TOKEN_THIS] = {this_, NULL, PREC_NONE},
     [TOKEN_IMPORT] = {NULL, NULL, PREC_NONE},
+    [TOKEN_STRUCT] = {NULL, NULL, PREC_NONE},
+    [TOKEN_SWITCH] = {NULL, NULL, PREC_NONE},
+    [TOKEN_CASE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_DEFAULT] = {NULL, NULL, PREC_NONE},
     [TOKEN_TRUE] = {literal, NULL, PREC_NONE},
     [TOKEN_LET] = {NULL, NULL, PREC_NONE},
     [TOKEN_CONST] = {NULL, NULL, PREC_NONE},
@@ -1405,6 +1748,8 @@ static void add_local(parser *p, compiler *c, token name) {
     l->name = name;
     l->depth = -1;
     l->is_captured = 0;
+    l->scratch_site = -1;
+    l->escapes = 0;
 }
 
 static void push_loop_stack(compiler *c, size_t cont_addr, long scope_depth, uint8_t sentinel) {
@@ -1530,6 +1875,7 @@ object_function *compile(const char* source, VM *vm) {
     consume(&p, TOKEN_EOF, "Expect end of expression.");
     object_function *f = end_compiler(&p, &c);
     destroy_compiler(&c, vm);
+    FREE_ARRAY(NULL, object_struct*, p.structs, p.struct_capacity);
     enable_gc(vm);
     return p.had_error ? NULL : f;
 }
@@ -1549,6 +1895,7 @@ object_function *compile_module(const char* source, VM *vm) {
     consume(&p, TOKEN_EOF, "Expect end of expression.");
     object_function *f = end_compiler(&p, &c);
     destroy_compiler(&c, vm);
+    FREE_ARRAY(NULL, object_struct*, p.structs, p.struct_capacity);
     enable_gc(vm);
     return p.had_error ? NULL : f;
 }
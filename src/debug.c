@@ -22,6 +22,11 @@ static size_t raw_byte_instruction(const char *name, segment *s, size_t offset)
     return offset + 2;
 }
 
+static size_t call_instruction(const char *name, segment *s, size_t offset) {
+    printf("%-16s %5u (%u wanted)\n", name, s->bytecode[offset+1], s->bytecode[offset+2]);
+    return offset + 3;
+}
+
 static size_t three_byte_instruction(const char *name, segment *s, size_t offset) {
     uint32_t arg = ((uint32_t) s->bytecode[offset+1] << 16) + ((uint32_t) s->bytecode[offset+2] << 8) + ((uint32_t) s->bytecode[offset+3]);
     printf("%-16s %5u\n", name, arg);
@@ -66,6 +71,15 @@ static size_t invoke_instruction(const char *name, segment *s, size_t offset, ui
     return offset + 1;
 }
 
+static size_t field_instruction(const char *name, segment *s, size_t offset, uint8_t is_long) {
+    uint8_t slot = s->bytecode[offset+1];
+    uint32_t constant = is_long ? (s->bytecode[offset+2] << 16) + (s->bytecode[offset+3] << 8) + (s->bytecode[offset+4]) : s->bytecode[offset+2];
+    printf("%-16s %5u '", name, constant);
+    print_value(s->constants.values[constant]);
+    printf("' (slot %u)\n", slot);
+    return is_long ? offset + 5 : offset + 3;
+}
+
 static size_t long_instruction(const char *name, segment *s, size_t offset) {
     printf("(%s)\n", name);
     offset++;
@@ -101,16 +115,22 @@ static size_t long_instruction(const char *name, segment *s, size_t offset) {
             return constant_long_instruction("OP_GET_PROPERTY_KEEP_REF", s, offset);
         case OP_SET_PROPERTY:
             return constant_long_instruction("OP_SET_PROPERTY", s, offset);
+        case OP_GET_FIELD:
+            return field_instruction("OP_GET_FIELD", s, offset, 1);
+        case OP_SET_FIELD:
+            return field_instruction("OP_SET_FIELD", s, offset, 1);
         case OP_METHOD:
             return constant_long_instruction("OP_METHOD", s, offset);
         case OP_INVOKE:
-            return invoke_instruction("OP_INVOKE", s, offset, 1);
+            return invoke_instruction("OP_INVOKE", s, offset, 1) + 8; // Skip inline cache and values wanted
         case OP_GET_SUPER:
-            return constant_long_instruction("OP_GET_SUPER", s, offset);
+            return constant_long_instruction("OP_GET_SUPER", s, offset) + 7; // Skip inline cache
         case OP_INVOKE_SUPER:
-            return invoke_instruction("OP_INVOKE_SUPER", s, offset, 1);
+            return invoke_instruction("OP_INVOKE_SUPER", s, offset, 1) + 8;
         case OP_IMPORT:
             return constant_long_instruction("OP_IMPORT", s, offset);
+        case OP_RELEASE_SCRATCH:
+            return three_byte_instruction("OP_RELEASE_SCRATCH", s, offset);
         default:
             return 1;
     }
@@ -182,6 +202,8 @@ size_t dissassemble_instruction(segment *s, size_t offset) {
             return simple_instruction("OP_POP", offset);
         case OP_MAKE_ARRAY:
             return simple_instruction("OP_MAKE_ARRAY", offset);
+        case OP_MAKE_ARRAY_SCRATCH:
+            return simple_instruction("OP_MAKE_ARRAY_SCRATCH", offset);
         case OP_ARRAY_GET:
             return simple_instruction("OP_ARRAY_GET", offset);
         case OP_ARRAY_GET_KEEP_REF:
@@ -204,12 +226,24 @@ size_t dissassemble_instruction(segment *s, size_t offset) {
             return simple_instruction("OP_MARK_ERRORS_HANDLED", offset);
         case OP_RAISE:
             return simple_instruction("OP_RAISE", offset);
+        case OP_SEAL_CLASS:
+            return simple_instruction("OP_SEAL_CLASS", offset);
+        case OP_STR_OVERRIDE:
+            return simple_instruction("OP_STR_OVERRIDE", offset);
+        case OP_SWITCH: {
+            uint32_t table = ((uint32_t) s->bytecode[offset+1] << 16) + ((uint32_t) s->bytecode[offset+2] << 8) + ((uint32_t) s->bytecode[offset+3]);
+            const char *kinds[5] = {"dense", "sparse", "string", "error", "generic"};
+            printf("%-16s %5u (%s, default -> %lu)\n", "OP_SWITCH", table, kinds[s->switches[table].kind], s->switches[table].default_target);
+            return offset + 4;
+        }
         case OP_CONSTANT:
             return constant_instruction("OP_CONSTANT", s, offset);
         case OP_POPN:
             return raw_byte_instruction("OP_POPN", s, offset);
+        case OP_RETURN_MULTI:
+            return raw_byte_instruction("OP_RETURN_MULTI", s, offset);
         case OP_CALL:
-            return raw_byte_instruction("OP_CALL", s, offset);
+            return call_instruction("OP_CALL", s, offset);
         case OP_PUSH_TYPEOF:
             return type_instruction("OP_PUSH_TYPEOF", s, offset);
         case OP_CONV_TYPE:
@@ -238,11 +272,12 @@ size_t dissassemble_instruction(segment *s, size_t offset) {
             return jump_instruction("OP_JUMP", s, 1, offset);
         case OP_LOOP:
             return jump_instruction("OP_LOOP", s, -1, offset);
-        case OP_CLOSURE: {
+        case OP_CLOSURE:
+        case OP_CLOSURE_SCRATCH: {
             offset++;
             uint32_t constant = ((uint32_t) s->bytecode[offset] << 16) + ((uint32_t) s->bytecode[offset+1] << 8) + ((uint32_t) s->bytecode[offset+2]);
             offset += 3;
-            printf("%-16s %5u ", "OP_CLOSURE", constant);
+            printf("%-16s %5u ", instruction == OP_CLOSURE ? "OP_CLOSURE" : "OP_CLOSURE_SCRATCH", constant);
             print_value(s->constants.values[constant]);
             printf("\n");
 
@@ -267,16 +302,22 @@ size_t dissassemble_instruction(segment *s, size_t offset) {
         case OP_SET_PROPERTY: {
             return constant_instruction("OP_SET_PROPERTY", s, offset);
         }
+        case OP_GET_FIELD:
+            return field_instruction("OP_GET_FIELD", s, offset, 0);
+        case OP_SET_FIELD:
+            return field_instruction("OP_SET_FIELD", s, offset, 0);
         case OP_METHOD:
             return constant_instruction("OP_METHOD", s, offset);
         case OP_INVOKE:
-            return invoke_instruction("OP_INVOKE", s, offset, 0);
+            return invoke_instruction("OP_INVOKE", s, offset, 0) + 8;
         case OP_GET_SUPER:
-            return constant_instruction("OP_GET_SUPER", s, offset);
+            return constant_instruction("OP_GET_SUPER", s, offset) + 7; // Skip inline cache
         case OP_INVOKE_SUPER:
-            return invoke_instruction("OP_INVOKE_SUPER", s, offset, 0);
+            return invoke_instruction("OP_INVOKE_SUPER", s, offset, 0) + 8;
         case OP_IMPORT:
             return constant_instruction("OP_IMPORT", s, offset);
+        case OP_RELEASE_SCRATCH:
+            return raw_byte_instruction("OP_RELEASE_SCRATCH", s, offset);
         case OP_BUILD_NAMESPACE: {
             uint8_t n = s->bytecode[offset + 1];
             printf("%-16s (%u exports)\n", "OP_BUILD_NAMESPACE", n);
@@ -125,10 +125,18 @@ void mark_hashmap(VM *vm, hashmap *h) {
     }
 }
 
+void hashmap_forward(hashmap *h) {
+    for (uint32_t i = 0; i < h->capacity; i++) { // Keys keep their hash, so moving them doesn't change where they sit
+        kv_pair *entry = &h->entries[i];
+        entry->k = (object_string*) forwarded((object*) entry->k);
+        forward_value(&entry->v);
+    }
+}
+
 void hashmap_remove_white(VM *vm, hashmap *h) {
     for (uint32_t i = 0; i < h->capacity; i++) {
         kv_pair *entry = &h->entries[i];
-        if (entry->k != NULL && !entry->k->obj.is_marked) {
+        if (entry->k != NULL && !is_marked((object*) entry->k)) {
             hashmap_delete(h, entry->k);
         }
     }
@@ -0,0 +1,496 @@
+#define _DEFAULT_SOURCE // For MAP_ANONYMOUS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "heap.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+static const uint32_t size_classes[HEAP_SIZE_CLASSES] = {16, 24, 32, 40, 48, 64, 80, 96, 128, 160, 192, 256, 384, 512, 768, 1024};
+static uint8_t class_lookup[HEAP_MAX_SLOT / 8 + 1]; // Size class index for each 8-byte-rounded request size
+
+typedef struct {
+    size_t size;
+    size_t padding; // Keeps the object itself 16-byte aligned
+} off_page_header;
+
+static void out_of_memory(void) {
+    fprintf(stderr, "Failed to allocate memory, exiting...\n");
+    exit(1);
+}
+
+static void append_object(object ***list, size_t *count, size_t *capacity, object *obj) {
+    if (*count >= *capacity) {
+        *capacity = GROW_CAPACITY(*capacity);
+        *list = realloc(*list, sizeof(object*) * *capacity);
+        if (*list == NULL) out_of_memory();
+    }
+    (*list)[(*count)++] = obj;
+}
+
+void init_heap(heap *h) {
+    for (uint8_t i = 0; i < HEAP_SIZE_CLASSES; i++) {
+        h->pages[i] = NULL;
+        h->current[i] = NULL;
+    }
+    h->large = NULL;
+    h->large_count = 0;
+    h->large_capacity = 0;
+    h->young = NULL;
+    h->young_count = 0;
+    h->young_capacity = 0;
+    h->remembered = NULL;
+    h->remembered_count = 0;
+    h->remembered_capacity = 0;
+    h->pending_sweeps = 0;
+    h->pending_garbage = 0;
+    h->arena = 0;
+    h->arena_cap = 0;
+    h->arena_bytes = 0;
+    h->arena_chunks = NULL;
+
+    uint8_t c = 0;
+    for (uint32_t i = 0; i <= HEAP_MAX_SLOT / 8; i++) {
+        while (size_classes[c] < i * 8) c++;
+        class_lookup[i] = c;
+    }
+}
+
+static heap_page *map_page(void) {
+    // Pages are mapped directly so that releasing one gives the memory back to the OS rather than to malloc
+    char *base = mmap(NULL, HEAP_PAGE_SIZE * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) out_of_memory();
+    char *aligned = (char*) (((uintptr_t) base + HEAP_PAGE_SIZE - 1) & ~(uintptr_t) (HEAP_PAGE_SIZE - 1));
+    if (aligned > base) munmap(base, aligned - base); // Trim the over-allocation on either side of the aligned page
+    munmap(aligned + HEAP_PAGE_SIZE, base + HEAP_PAGE_SIZE - aligned);
+    return (heap_page*) aligned;
+}
+
+static void unmap_page(heap_page *page) {
+    munmap(page, HEAP_PAGE_SIZE);
+}
+
+static heap_page *new_page(heap *h, uint8_t size_class) {
+    heap_page *page = map_page();
+    page->slot_size = size_classes[size_class];
+    page->slot_count = (HEAP_PAGE_SIZE - HEAP_PAGE_HEADER) / page->slot_size;
+    page->free_list = NULL;
+    page->bump = 0;
+    page->live = 0;
+    page->needs_sweep = 0;
+    memset(page->mark_bits, 0, sizeof(page->mark_bits));
+    memset(page->alloc_bits, 0, sizeof(page->alloc_bits));
+    page->next = h->pages[size_class]; // Every other page of this class is full, so putting it first keeps the invariant on current
+    h->pages[size_class] = page;
+    return page;
+}
+
+static inline int page_has_space(heap_page *page) {
+    return page->free_list != NULL || page->bump < page->slot_count;
+}
+
+static void sweep_pending_page(VM *vm, heap_page *page);
+
+static object *take_slot(VM *vm, uint8_t size_class) {
+    heap *h = &vm->heap;
+    heap_page *page = h->current[size_class];
+    while (page != NULL) {
+        if (page->needs_sweep) { // Pages are swept on their way back into use
+            size_t before = vm->bytes_allocated;
+            sweep_pending_page(vm, page);
+            vm->gc_stats.bytes_freed += before - vm->bytes_allocated;
+        }
+        if (page_has_space(page)) break;
+        page = page->next;
+    }
+    if (page == NULL) page = new_page(h, size_class);
+    h->current[size_class] = page;
+
+    uint32_t index;
+    object *obj;
+    if (page->free_list != NULL) {
+        obj = page->free_list;
+        page->free_list = *(void**) obj;
+        index = slot_index(page, obj);
+    }
+    else {
+        index = page->bump++;
+        obj = (object*) ((char*) page + HEAP_PAGE_HEADER + (size_t) index * page->slot_size);
+    }
+    page->alloc_bits[index >> 6] |= (uint64_t) 1 << (index & 63);
+    page->live++;
+    return obj;
+}
+
+static object *allocate_off_page(size_t size) {
+    off_page_header *header = malloc(sizeof(off_page_header) + size);
+    if (header == NULL) out_of_memory();
+    header->size = size;
+    return (object*) (header + 1);
+}
+
+static size_t off_page_size(object *obj) {
+    return ((off_page_header*) obj - 1)->size;
+}
+
+static object *arena_allocate(VM *vm, size_t size) {
+    heap *h = &vm->heap;
+    size_t needed = sizeof(size_t) + ((size + 7) & ~(size_t) 7);
+    arena_chunk *chunk = h->arena_chunks;
+    if (chunk == NULL || chunk->used + needed > chunk->size) {
+        size_t chunk_size = sizeof(arena_chunk) + needed > HEAP_ARENA_CHUNK ? sizeof(arena_chunk) + needed : HEAP_ARENA_CHUNK;
+        chunk = mmap(NULL, chunk_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED) out_of_memory();
+        chunk->size = chunk_size;
+        chunk->used = sizeof(arena_chunk);
+        chunk->next = h->arena_chunks;
+        h->arena_chunks = chunk;
+    }
+    size_t *header = (size_t*) ((char*) chunk + chunk->used);
+    *header = size;
+    chunk->used += needed;
+    h->arena_bytes += needed;
+    vm->bytes_allocated += size;
+    if (vm->heap_limit != 0 && vm->bytes_allocated > vm->heap_limit) enforce_heap_limit(vm);
+    object *obj = (object*) (header + 1);
+    obj->flags = OBJ_FLAG_ARENA | OBJ_FLAG_MARKED; // Marked means old, so the write barrier remembers arena objects that point at young ones
+    return obj;
+}
+
+object *heap_allocate(VM *vm, size_t size) {
+    heap *h = &vm->heap;
+    if (h->arena) {
+        if (h->arena_cap == 0 || h->arena_bytes + size <= h->arena_cap) return arena_allocate(vm, size);
+        h->arena = 0; // Past the cap, so collect as normal from here on - the arena's objects just live for good
+    }
+    size_t charged = size <= HEAP_MAX_SLOT ? size_classes[class_lookup[(size + 7) / 8]] : size;
+    // Collect before the slot is claimed, otherwise the sweep would see an allocated but uninitialised object
+    vm->bytes_allocated += charged;
+    #ifdef DEBUG_STRESS_GC
+        collect_garbage(vm);
+    #else
+        if (vm->gc_allowed && vm->bytes_allocated > vm->gc_threshold) {
+            collect_garbage(vm);
+        }
+    #endif
+    if (vm->heap_limit != 0 && vm->bytes_allocated > vm->heap_limit) enforce_heap_limit(vm);
+
+    object *obj;
+    if (size <= HEAP_MAX_SLOT) {
+        obj = take_slot(vm, class_lookup[(size + 7) / 8]);
+        obj->flags = 0;
+        append_object(&h->young, &h->young_count, &h->young_capacity, obj);
+    }
+    else { // Large objects are few enough that every collection just walks the whole list
+        obj = allocate_off_page(size);
+        obj->flags = OBJ_FLAG_LARGE;
+        append_object(&h->large, &h->large_count, &h->large_capacity, obj);
+    }
+    return obj;
+}
+
+object *heap_allocate_scratch(VM *vm, size_t size) {
+    vm->bytes_allocated += size;
+    #ifdef DEBUG_STRESS_GC
+        collect_garbage(vm);
+    #else
+        if (vm->gc_allowed && vm->bytes_allocated > vm->gc_threshold) {
+            collect_garbage(vm);
+        }
+    #endif
+    if (vm->heap_limit != 0 && vm->bytes_allocated > vm->heap_limit) enforce_heap_limit(vm);
+    object *obj = allocate_off_page(size);
+    obj->flags = OBJ_FLAG_SCRATCH;
+    return obj;
+}
+
+void heap_free(VM *vm, object *obj) {
+    if (obj->flags & OBJ_FLAG_ARENA) { // Only at teardown, and the chunk goes with the rest of the arena
+        vm->bytes_allocated -= ((size_t*) obj)[-1];
+        return;
+    }
+    if (obj->flags & OBJ_FLAG_OFF_PAGE) { // Large objects are dropped from the list by whoever frees them (sweep or destroy)
+        vm->bytes_allocated -= off_page_size(obj);
+        free((off_page_header*) obj - 1);
+        return;
+    }
+    heap_page *page = page_of(obj);
+    uint32_t index = slot_index(page, obj);
+    page->alloc_bits[index >> 6] &= ~((uint64_t) 1 << (index & 63));
+    page->live--;
+    *(void**) obj = page->free_list;
+    page->free_list = obj;
+    vm->bytes_allocated -= page->slot_size;
+}
+
+void heap_remember(heap *h, object *obj) {
+    obj->flags |= OBJ_FLAG_REMEMBERED;
+    append_object(&h->remembered, &h->remembered_count, &h->remembered_capacity, obj);
+}
+
+void heap_forget_remembered(heap *h) {
+    for (size_t i = 0; i < h->remembered_count; i++) {
+        h->remembered[i]->flags &= ~OBJ_FLAG_REMEMBERED;
+    }
+    h->remembered_count = 0;
+}
+
+void heap_clear_marks(heap *h) {
+    for (uint8_t c = 0; c < HEAP_SIZE_CLASSES; c++) {
+        for (heap_page *page = h->pages[c]; page != NULL; page = page->next) {
+            memset(page->mark_bits, 0, sizeof(page->mark_bits));
+        }
+    }
+    for (size_t i = 0; i < h->large_count; i++) {
+        h->large[i]->flags &= ~OBJ_FLAG_MARKED;
+    }
+}
+
+static void sweep_page(VM *vm, heap_page *page) {
+    uint32_t words = (page->bump + 63) / 64;
+    for (uint32_t w = 0; w < words; w++) {
+        uint64_t dead = page->alloc_bits[w] & ~page->mark_bits[w];
+        while (dead != 0) {
+            uint32_t bit = __builtin_ctzll(dead);
+            dead &= dead - 1;
+            object *obj = (object*) ((char*) page + HEAP_PAGE_HEADER + (size_t) (w * 64 + bit) * page->slot_size);
+            free_object(vm, obj);
+        }
+    }
+}
+
+static void sweep_pending_page(VM *vm, heap_page *page) {
+    sweep_page(vm, page);
+    page->needs_sweep = 0;
+    vm->heap.pending_sweeps--;
+}
+
+static void sweep_young(VM *vm) {
+    heap *h = &vm->heap;
+    for (size_t i = 0; i < h->young_count; i++) {
+        if (!is_marked(h->young[i])) free_object(vm, h->young[i]);
+    }
+    for (uint8_t c = 0; c < HEAP_SIZE_CLASSES; c++) { // Freed slots can be on any page, so allocation restarts from the front
+        h->current[c] = h->pages[c];
+    }
+}
+
+static void defer_sweeping(heap *h) {
+    // The marks stay put until the next major collection, so pages can be swept whenever allocation gets round to them
+    for (uint8_t c = 0; c < HEAP_SIZE_CLASSES; c++) {
+        for (heap_page *page = h->pages[c]; page != NULL; page = page->next) {
+            uint32_t marked = 0;
+            for (uint32_t w = 0; w < (page->bump + 63) / 64; w++) marked += __builtin_popcountll(page->mark_bits[w]);
+            if (marked == page->live) continue; // Nothing died here
+            if (!page->needs_sweep) h->pending_sweeps++;
+            page->needs_sweep = 1;
+            h->pending_garbage += (size_t) (page->live - marked) * page->slot_size;
+        }
+        h->current[c] = h->pages[c];
+    }
+}
+
+void heap_finish_sweeping(VM *vm) {
+    heap *h = &vm->heap;
+    size_t before = vm->bytes_allocated;
+    for (uint8_t c = 0; c < HEAP_SIZE_CLASSES; c++) {
+        heap_page **link = &h->pages[c];
+        while (*link != NULL) {
+            heap_page *page = *link;
+            if (page->needs_sweep) sweep_pending_page(vm, page);
+            if (page->live == 0 && (page != h->pages[c] || page->next != NULL)) { // Hand empty pages back, but keep one per class warm
+                *link = page->next;
+                unmap_page(page);
+            }
+            else {
+                link = &page->next;
+            }
+        }
+        h->current[c] = h->pages[c];
+    }
+    h->pending_garbage = 0;
+    vm->gc_stats.bytes_freed += before - vm->bytes_allocated;
+}
+
+static void sweep_some_pending(VM *vm, size_t pages) {
+    heap *h = &vm->heap;
+    for (uint8_t c = 0; c < HEAP_SIZE_CLASSES && pages > 0 && h->pending_sweeps > 0; c++) {
+        for (heap_page *page = h->pages[c]; page != NULL && pages > 0; page = page->next) {
+            if (!page->needs_sweep) continue;
+            sweep_pending_page(vm, page);
+            pages--;
+        }
+    }
+    if (h->pending_sweeps == 0) h->pending_garbage = 0;
+}
+
+void heap_sweep(VM *vm, uint8_t major) { // Survivors keep their marks, which is what makes them old
+    heap *h = &vm->heap;
+    if (major) {
+        defer_sweeping(h);
+    }
+    else {
+        sweep_young(vm);
+        sweep_some_pending(vm, GC_LAZY_SWEEP_PAGES);
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < h->large_count; i++) {
+        object *obj = h->large[i];
+        if (obj->flags & OBJ_FLAG_MARKED) {
+            h->large[kept++] = obj;
+        }
+        else {
+            free_object(vm, obj);
+        }
+    }
+    h->large_count = kept;
+    h->young_count = 0;
+}
+
+static void evacuate_page(VM *vm, heap_page *page, uint8_t size_class) {
+    for (uint32_t w = 0; w < (page->bump + 63) / 64; w++) {
+        uint64_t live = page->alloc_bits[w];
+        while (live != 0) {
+            uint32_t bit = __builtin_ctzll(live);
+            live &= live - 1;
+            object *obj = (object*) ((char*) page + HEAP_PAGE_HEADER + (size_t) (w * 64 + bit) * page->slot_size);
+            object *copy = take_slot(vm, size_class);
+            memcpy(copy, obj, page->slot_size);
+            if ((page->mark_bits[w] >> bit) & 1) set_marked(copy); // Keeps the object's age
+            if (obj->type == OBJ_UPVALUE) { // A closed upvalue points at its own copy of the value
+                object_upvalue *upvalue = (object_upvalue*) obj;
+                if (upvalue->location == &upvalue->closed) ((object_upvalue*) copy)->location = &((object_upvalue*) copy)->closed;
+            }
+            obj->flags |= OBJ_FLAG_FORWARDED;
+            ((object**) obj)[1] = copy;
+        }
+    }
+}
+
+heap_page *heap_evacuate(VM *vm) {
+    // Only valid once sweeping is finished, as every allocated slot is then assumed to be live
+    heap *h = &vm->heap;
+    heap_page *evacuated = NULL;
+    for (uint8_t c = 0; c < HEAP_SIZE_CLASSES; c++) {
+        uint32_t sparse_pages = 0;
+        size_t moving = 0;
+        size_t room = 0;
+        for (heap_page *page = h->pages[c]; page != NULL; page = page->next) {
+            if (page->live * HEAP_COMPACT_OCCUPANCY < page->slot_count) {
+                sparse_pages++;
+                moving += page->live;
+            }
+            else {
+                room += page->slot_count - page->live;
+            }
+        }
+        // A lone sparse page is only worth moving if its objects fit in the gaps elsewhere
+        if (sparse_pages == 0 || (sparse_pages == 1 && moving > room)) continue;
+
+        heap_page *sparse = NULL;
+        heap_page **link = &h->pages[c];
+        while (*link != NULL) { // Unlink the sparse pages first so nothing gets copied into one of them
+            heap_page *page = *link;
+            if (page->live * HEAP_COMPACT_OCCUPANCY < page->slot_count) {
+                *link = page->next;
+                page->next = sparse;
+                sparse = page;
+            }
+            else {
+                link = &page->next;
+            }
+        }
+        h->current[c] = h->pages[c];
+        while (sparse != NULL) {
+            heap_page *page = sparse;
+            sparse = page->next;
+            evacuate_page(vm, page, c);
+            page->next = evacuated;
+            evacuated = page;
+        }
+    }
+    return evacuated;
+}
+
+void heap_visit_arena(VM *vm, void (*visit)(VM *vm, object *obj)) {
+    for (arena_chunk *chunk = vm->heap.arena_chunks; chunk != NULL; chunk = chunk->next) {
+        char *p = (char*) chunk + sizeof(arena_chunk);
+        while (p < (char*) chunk + chunk->used) {
+            size_t size = *(size_t*) p;
+            visit(vm, (object*) (p + sizeof(size_t)));
+            p += sizeof(size_t) + ((size + 7) & ~(size_t) 7);
+        }
+    }
+}
+
+void heap_visit_objects(VM *vm, void (*visit)(VM *vm, object *obj)) {
+    heap *h = &vm->heap;
+    heap_visit_arena(vm, visit);
+    for (uint8_t c = 0; c < HEAP_SIZE_CLASSES; c++) {
+        for (heap_page *page = h->pages[c]; page != NULL; page = page->next) {
+            for (uint32_t w = 0; w < (page->bump + 63) / 64; w++) {
+                uint64_t live = page->alloc_bits[w];
+                while (live != 0) {
+                    uint32_t bit = __builtin_ctzll(live);
+                    live &= live - 1;
+                    visit(vm, (object*) ((char*) page + HEAP_PAGE_HEADER + (size_t) (w * 64 + bit) * page->slot_size));
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < h->large_count; i++) {
+        visit(vm, h->large[i]);
+    }
+}
+
+void heap_forward_lists(heap *h) {
+    for (size_t i = 0; i < h->young_count; i++) {
+        h->young[i] = forwarded(h->young[i]);
+    }
+    for (size_t i = 0; i < h->remembered_count; i++) {
+        h->remembered[i] = forwarded(h->remembered[i]);
+    }
+}
+
+size_t heap_release_pages(heap_page *pages) {
+    size_t released = 0;
+    while (pages != NULL) {
+        heap_page *next = pages->next;
+        unmap_page(pages);
+        pages = next;
+        released++;
+    }
+    return released;
+}
+
+void destroy_heap(VM *vm) {
+    heap *h = &vm->heap;
+    for (uint8_t c = 0; c < HEAP_SIZE_CLASSES; c++) {
+        heap_page *page = h->pages[c];
+        while (page != NULL) {
+            memset(page->mark_bits, 0, sizeof(page->mark_bits)); // Nothing is marked, so sweeping frees every live slot
+            sweep_page(vm, page);
+            heap_page *next = page->next;
+            unmap_page(page);
+            page = next;
+        }
+        h->pages[c] = NULL;
+        h->current[c] = NULL;
+    }
+    for (size_t i = 0; i < h->large_count; i++) {
+        free_object(vm, h->large[i]);
+    }
+    heap_visit_arena(vm, free_object); // Only releases what the objects own, the objects themselves go with their chunks
+    while (h->arena_chunks != NULL) {
+        arena_chunk *next = h->arena_chunks->next;
+        munmap(h->arena_chunks, h->arena_chunks->size);
+        h->arena_chunks = next;
+    }
+    free(h->large);
+    free(h->young);
+    free(h->remembered);
+    init_heap(h);
+}
@@ -0,0 +1,89 @@
+#ifndef canidae_heap_h
+
+#define canidae_heap_h
+
+#include "common.h"
+#include "value.h"
+
+#define HEAP_PAGE_SIZE (64 * 1024) // Pages are aligned to their size so an object's page is found by masking its address
+#define HEAP_MIN_SLOT 16
+#define HEAP_MAX_SLOT 1024 // Anything bigger gets its own allocation on the large object list
+#define HEAP_SIZE_CLASSES 16
+#define HEAP_BITMAP_WORDS (HEAP_PAGE_SIZE / HEAP_MIN_SLOT / 64)
+
+#define OBJ_FLAG_LARGE 0x1 // Allocated outside the pages, mark bit lives in the header
+#define OBJ_FLAG_SCRATCH 0x2 // Frame-local, owned by vm->scratch rather than the heap
+#define OBJ_FLAG_ARENA 0x20 // Bump-allocated in arena mode and never freed, so permanently marked
+#define OBJ_FLAG_OFF_PAGE (OBJ_FLAG_LARGE | OBJ_FLAG_SCRATCH | OBJ_FLAG_ARENA)
+#define OBJ_FLAG_REMEMBERED 0x4 // Already in the remembered set
+#define OBJ_FLAG_FORWARDED 0x8 // Moved by compaction, the new address is in the word after the header
+#define OBJ_FLAG_MARKED 0x10 // Mark bit for off-page objects, page-resident ones keep theirs in the page bitmap
+
+#define HEAP_ARENA_CHUNK (1024 * 1024)
+typedef struct heap_page {
+    struct heap_page *next;
+    void *free_list; // Swept slots, linked through their first word
+    uint32_t slot_size;
+    uint32_t slot_count;
+    uint32_t bump; // Index of the first slot that has never been handed out
+    uint32_t live;
+    uint8_t needs_sweep; // Marked by a major collection that hasn't been swept yet
+    uint64_t mark_bits[HEAP_BITMAP_WORDS];
+    uint64_t alloc_bits[HEAP_BITMAP_WORDS];
+} heap_page;
+
+#define HEAP_COMPACT_OCCUPANCY 4 // Pages less than a quarter full are evacuated by compaction
+
+#define HEAP_PAGE_HEADER ((sizeof(heap_page) + 15) & ~(size_t) 15)
+
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size; // Mapped bytes, including this header
+    size_t used; // Objects are packed from the end of the header, each preceded by its size
+} arena_chunk;
+
+typedef struct {
+    heap_page *pages[HEAP_SIZE_CLASSES];
+    heap_page *current[HEAP_SIZE_CLASSES]; // Page allocation resumes from; every page before it is swept and full
+    object **large;
+    size_t large_count;
+    size_t large_capacity;
+    object **young; // Page objects allocated since the last collection - marks are sticky, so anything marked is old
+    size_t young_count;
+    size_t young_capacity;
+    object **remembered; // Old objects that have been given a pointer to a young one since the last collection
+    size_t remembered_count;
+    size_t remembered_capacity;
+    size_t pending_sweeps; // Pages still waiting to be swept after the last major collection
+    size_t pending_garbage; // Bytes of dead objects on those pages
+    uint8_t arena; // Objects are being bump-allocated and nothing is collected
+    size_t arena_cap; // Arena bytes after which collection starts, 0 for never
+    size_t arena_bytes;
+    arena_chunk *arena_chunks; // Newest first - outlive arena mode, as their objects are never freed
+} heap;
+
+void init_heap(heap *h);
+object *heap_allocate(VM *vm, size_t size);
+object *heap_allocate_scratch(VM *vm, size_t size);
+void heap_free(VM *vm, object *obj);
+void heap_remember(heap *h, object *obj);
+void heap_forget_remembered(heap *h);
+void heap_clear_marks(heap *h);
+void heap_sweep(VM *vm, uint8_t major);
+void heap_finish_sweeping(VM *vm);
+void heap_visit_arena(VM *vm, void (*visit)(VM *vm, object *obj));
+heap_page *heap_evacuate(VM *vm);
+void heap_visit_objects(VM *vm, void (*visit)(VM *vm, object *obj));
+void heap_forward_lists(heap *h);
+size_t heap_release_pages(heap_page *pages);
+void destroy_heap(VM *vm);
+
+static inline heap_page *page_of(object *obj) {
+    return (heap_page*) ((uintptr_t) obj & ~(uintptr_t) (HEAP_PAGE_SIZE - 1));
+}
+
+static inline uint32_t slot_index(heap_page *page, object *obj) {
+    return (uint32_t) (((char*) obj - ((char*) page + HEAP_PAGE_HEADER)) / page->slot_size);
+}
+
+#endif
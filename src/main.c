@@ -43,29 +43,154 @@ static char *read_file(const char *path) {
     return buffer;
 }
 
-static void run_file(VM *vm, const char *path) {
+static int run_file(VM *vm, const char *path) {
     char *source = read_file(path);
     interpret_result result = interpret(vm, source);
     free(source);
 
-    if (result == INTERPRET_COMPILE_ERROR) exit(65);
-    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+    if (result == INTERPRET_COMPILE_ERROR) return 65;
+    if (result == INTERPRET_RUNTIME_ERROR) return 70;
+    return 0;
+}
+
+static void print_gc_stats(VM *vm) {
+    gc_statistics *stats = &vm->gc_stats;
+    fprintf(stderr, "[gc] %lu minor, %lu major in %lu steps, pause max %.3fms total %.3fms, %zu bytes freed, %lu pages compacted\n",
+        (unsigned long) stats->minor_collections, (unsigned long) stats->major_collections, (unsigned long) stats->mark_steps,
+        stats->max_pause_ns / 1e6, stats->total_pause_ns / 1e6, stats->bytes_freed, (unsigned long) stats->pages_compacted);
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: canidae [--gc-stats] [--gc-budget microseconds] [--gc-threads n] [--compact] [--heap-limit bytes]\n"
+                    "               [--gc-initial bytes] [--gc-growth factor] [--gc-min-heap bytes] [--gc-max-heap bytes]\n"
+                    "               [--gc-nursery bytes] [--gc-adaptive percent] [--arena] [--arena-cap bytes]\n"
+                    "               [--max-depth frames] [--stack-size bytes] [file]\n"
+                    "Sizes are in bytes, with an optional K, M or G suffix.\n");
+    exit(64);
+}
+
+static uint8_t parse_size(const char *text, size_t *size) { // Byte count with an optional binary K, M or G suffix
+    char *end;
+    double n = strtod(text, &end);
+    if (end == text || n < 0) return 0;
+    switch (*end) {
+        case 'K': case 'k': n *= 1024; end++; break;
+        case 'M': case 'm': n *= 1024 * 1024; end++; break;
+        case 'G': case 'g': n *= 1024 * 1024 * 1024; end++; break;
+    }
+    if (*end != '\0') return 0;
+    *size = (size_t) n;
+    return 1;
 }
 
 int main(int argc, const char *argv[]) {
     VM vm;
     init_VM(&vm);
-    
-    if (argc == 1) {
+
+    const char *path = NULL;
+    uint8_t show_gc_stats = 0;
+    const char *limit = getenv("CANIDAE_HEAP_LIMIT"); // The flag takes precedence
+    size_t heap_limit;
+    size_t stack_size;
+    gc_config config = vm.gc_config;
+    uint8_t arena = 0;
+    size_t arena_cap = 0;
+    if (limit != NULL) {
+        if (!parse_size(limit, &heap_limit)) {
+            fprintf(stderr, "Invalid CANIDAE_HEAP_LIMIT \"%s\".\n", limit);
+            exit(64);
+        }
+        set_heap_limit(&vm, heap_limit);
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--gc-stats") == 0) {
+            show_gc_stats = 1;
+        }
+        else if (strcmp(argv[i], "--gc-budget") == 0) { // Upper bound on each incremental marking step
+            if (i + 1 >= argc) usage();
+            char *end;
+            double budget = strtod(argv[++i], &end);
+            if (*end != '\0' || budget < 0) usage();
+            vm.gc_step_budget = (uint64_t) (budget * 1000);
+        }
+        else if (strcmp(argv[i], "--gc-threads") == 0) { // Marking threads, counting the one running the program
+            if (i + 1 >= argc) usage();
+            char *end;
+            long threads = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || threads < 1 || threads > GC_THREADS_MAX) usage();
+            vm.gc_threads = (uint32_t) threads;
+        }
+        else if (strcmp(argv[i], "--compact") == 0) { // Move objects out of sparse pages after major collections
+            vm.gc_compact = 1;
+        }
+        else if (strcmp(argv[i], "--gc-initial") == 0) {
+            if (i + 1 >= argc || !parse_size(argv[++i], &config.initial_threshold)) usage();
+        }
+        else if (strcmp(argv[i], "--gc-growth") == 0) {
+            if (i + 1 >= argc) usage();
+            char *end;
+            config.growth_factor = strtod(argv[++i], &end);
+            if (*end != '\0' || config.growth_factor <= 1) usage();
+        }
+        else if (strcmp(argv[i], "--gc-min-heap") == 0) {
+            if (i + 1 >= argc || !parse_size(argv[++i], &config.min_heap)) usage();
+        }
+        else if (strcmp(argv[i], "--gc-max-heap") == 0) {
+            if (i + 1 >= argc || !parse_size(argv[++i], &config.max_heap)) usage();
+        }
+        else if (strcmp(argv[i], "--gc-nursery") == 0) {
+            if (i + 1 >= argc || !parse_size(argv[++i], &config.nursery_size) || config.nursery_size == 0) usage();
+        }
+        else if (strcmp(argv[i], "--gc-adaptive") == 0) { // Target share of run time spent collecting, as a percentage
+            if (i + 1 >= argc) usage();
+            char *end;
+            config.target_percent = strtod(argv[++i], &end);
+            if (*end != '\0' || config.target_percent <= 0 || config.target_percent >= 100) usage();
+            config.adaptive = 1;
+        }
+        else if (strcmp(argv[i], "--arena") == 0) { // Never collect, for short-lived scripts
+            arena = 1;
+        }
+        else if (strcmp(argv[i], "--arena-cap") == 0) { // Arena mode until this many bytes, then collect as usual
+            if (i + 1 >= argc || !parse_size(argv[++i], &arena_cap) || arena_cap == 0) usage();
+            arena = 1;
+        }
+        else if (strcmp(argv[i], "--heap-limit") == 0) { // Heap size past which allocation raises a MemoryError
+            if (i + 1 >= argc || !parse_size(argv[++i], &heap_limit)) usage();
+            set_heap_limit(&vm, heap_limit);
+        }
+        else if (strcmp(argv[i], "--max-depth") == 0) { // Call depth past which a RecursionError is raised
+            if (i + 1 >= argc) usage();
+            char *end;
+            long depth = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || depth < 1 || depth > UINT32_MAX) usage();
+            set_max_depth(&vm, (uint32_t) depth);
+        }
+        else if (strcmp(argv[i], "--stack-size") == 0) { // Bytes reserved for the value stack, past which a RecursionError is raised
+            if (i + 1 >= argc || !parse_size(argv[++i], &stack_size) || stack_size < STACK_COMMIT_CHUNK) usage();
+            set_stack_size(&vm, stack_size);
+        }
+        else if (argv[i][0] == '-' || path != NULL) {
+            usage();
+        }
+        else {
+            path = argv[i];
+        }
+    }
+
+    if (config.max_heap != 0 && config.max_heap < config.min_heap) usage();
+    set_gc_config(&vm, &config);
+    if (arena) enable_arena(&vm, arena_cap);
+
+    int status = 0;
+    if (path == NULL) {
         repl(&vm);
-    } else if (argc == 2) {
-        vm.source_path = argv[1];
-        run_file(&vm, argv[1]);
     } else {
-        fprintf(stderr, "Usage: canidae [file]\n");
-        exit(64);
+        vm.source_path = path;
+        status = run_file(&vm, path);
     }
 
-    destroy_VM(&vm);
-    return 0;
+    if (show_gc_stats) print_gc_stats(&vm);
+    if (!arena) destroy_VM(&vm); // The process is about to exit anyway, and skipping teardown is much of what arena mode is for
+    return status;
 }
\ No newline at end of file
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include "marker.h"
+#include "memory.h"
+#include "vm.h"
+
+#define MARKER_TAKE_OWN 64 // Entries a worker moves back from its own shared deque at a time
+
+_Thread_local mark_worker *current_marker = NULL;
+
+static void ensure_capacity(object ***items, size_t *capacity, size_t needed) {
+    if (needed <= *capacity) return;
+    while (*capacity < needed) *capacity = GROW_CAPACITY(*capacity);
+    *items = realloc(*items, sizeof(object*) * *capacity);
+    if (*items == NULL) {
+        fprintf(stderr, "Failed to allocate memory, exiting...\n");
+        exit(1);
+    }
+}
+
+static void share_work(mark_worker *worker) {
+    // The older half of the local stack goes to the shared deque, where idle workers can steal it
+    size_t n = worker->local_count / 2;
+    pthread_mutex_lock(&worker->lock);
+    ensure_capacity(&worker->shared, &worker->shared_capacity, worker->shared_count + n);
+    memcpy(worker->shared + worker->shared_count, worker->local, n * sizeof(object*));
+    __atomic_store_n(&worker->shared_count, worker->shared_count + n, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&worker->lock);
+    memmove(worker->local, worker->local + n, (worker->local_count - n) * sizeof(object*));
+    worker->local_count -= n;
+}
+
+void marker_push(mark_worker *worker, object *obj) {
+    ensure_capacity(&worker->local, &worker->local_capacity, worker->local_count + 1);
+    worker->local[worker->local_count++] = obj;
+    if (worker->local_count >= MARKER_LOCAL_MAX ||
+        (worker->local_count >= MARKER_SHARE_MIN && __atomic_load_n(&worker->shared_count, __ATOMIC_RELAXED) == 0)) {
+        share_work(worker);
+    }
+}
+
+static size_t take_work(mark_worker *into, mark_worker *from, uint8_t steal) {
+    if (__atomic_load_n(&from->shared_count, __ATOMIC_ACQUIRE) == 0) return 0; // Cheap check before taking the lock
+    pthread_mutex_lock(&from->lock);
+    size_t n = steal ? (from->shared_count + 1) / 2 : (from->shared_count < MARKER_TAKE_OWN ? from->shared_count : MARKER_TAKE_OWN);
+    size_t remaining = from->shared_count - n;
+    ensure_capacity(&into->local, &into->local_capacity, into->local_count + n);
+    memcpy(into->local + into->local_count, from->shared + remaining, n * sizeof(object*));
+    __atomic_store_n(&from->shared_count, remaining, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&from->lock);
+    into->local_count += n;
+    return n;
+}
+
+static object *next_grey(marker_pool *pool, mark_worker *worker) {
+    if (worker->local_count > 0) return worker->local[--worker->local_count];
+    if (take_work(worker, worker, 0) > 0) return worker->local[--worker->local_count];
+    uint32_t self = (uint32_t) (worker - pool->workers);
+    for (uint32_t i = 1; i < pool->count; i++) {
+        mark_worker *victim = &pool->workers[(self + i) % pool->count];
+        if (take_work(worker, victim, 1) > 0) return worker->local[--worker->local_count];
+    }
+    return NULL;
+}
+
+static uint8_t any_shared_work(marker_pool *pool) {
+    for (uint32_t i = 0; i < pool->count; i++) {
+        if (__atomic_load_n(&pool->workers[i].shared_count, __ATOMIC_ACQUIRE) > 0) return 1;
+    }
+    return 0;
+}
+
+static void run_worker(marker_pool *pool, mark_worker *worker) {
+    size_t work = 0;
+    for (;;) {
+        object *obj = next_grey(pool, worker);
+        if (obj != NULL) {
+            pool->blacken(pool->vm, obj);
+            if (++work % GC_STEP_CHUNK == 0 && work >= pool->min_work && pool->deadline != UINT64_MAX && gc_now_ns() >= pool->deadline) {
+                __atomic_store_n(&pool->stop, 1, __ATOMIC_RELAXED);
+            }
+            if (__atomic_load_n(&pool->stop, __ATOMIC_RELAXED)) return; // Anything left over is gathered up by the collecting thread
+            continue;
+        }
+        // Out of work - only an active worker can create more, so once none are active the trace is done
+        __atomic_sub_fetch(&pool->active, 1, __ATOMIC_ACQ_REL);
+        for (;;) {
+            if (__atomic_load_n(&pool->stop, __ATOMIC_RELAXED) || __atomic_load_n(&pool->active, __ATOMIC_ACQUIRE) == 0) return;
+            if (any_shared_work(pool)) {
+                __atomic_add_fetch(&pool->active, 1, __ATOMIC_ACQ_REL);
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+static void *marker_thread(void *arg) {
+    mark_worker *worker = arg;
+    marker_pool *pool = worker->pool;
+    uint64_t seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->shutdown && pool->epoch == seen) pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->epoch;
+        pthread_mutex_unlock(&pool->lock);
+
+        current_marker = worker;
+        run_worker(pool, worker);
+        current_marker = NULL;
+
+        pthread_mutex_lock(&pool->lock);
+        if (++pool->finished == pool->count - 1) pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+marker_pool *start_markers(VM *vm, uint32_t count) {
+    marker_pool *pool = malloc(sizeof(marker_pool));
+    if (pool == NULL) exit(1);
+    pool->vm = vm;
+    pool->count = count;
+    pool->workers = calloc(count, sizeof(mark_worker));
+    if (pool->workers == NULL) exit(1);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->epoch = 0;
+    pool->finished = 0;
+    pool->shutdown = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        pool->workers[i].pool = pool;
+        pthread_mutex_init(&pool->workers[i].lock, NULL);
+    }
+    for (uint32_t i = 1; i < count; i++) { // Worker 0 is whichever thread is collecting
+        if (pthread_create(&pool->workers[i].thread, NULL, marker_thread, &pool->workers[i]) != 0) {
+            fprintf(stderr, "Failed to start GC marker thread, exiting...\n");
+            exit(1);
+        }
+    }
+    return pool;
+}
+
+void stop_markers(marker_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (uint32_t i = 0; i < pool->count; i++) {
+        if (i > 0) pthread_join(pool->workers[i].thread, NULL);
+        pthread_mutex_destroy(&pool->workers[i].lock);
+        free(pool->workers[i].local);
+        free(pool->workers[i].shared);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool);
+}
+
+uint8_t parallel_trace(marker_pool *pool, blacken_function blacken, uint64_t deadline, size_t min_work) {
+    VM *vm = pool->vm;
+    for (long i = 0; i < vm->grey_count; i++) { // Deal the grey stack out so every worker starts with something
+        mark_worker *worker = &pool->workers[i % pool->count];
+        ensure_capacity(&worker->shared, &worker->shared_capacity, worker->shared_count + 1);
+        worker->shared[worker->shared_count++] = vm->grey_stack[i];
+    }
+    vm->grey_count = 0;
+    pool->blacken = blacken;
+    pool->deadline = deadline;
+    pool->min_work = min_work;
+    pool->stop = 0;
+    pool->active = pool->count;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->finished = 0;
+    pool->epoch++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    current_marker = &pool->workers[0];
+    run_worker(pool, &pool->workers[0]);
+    current_marker = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->finished < pool->count - 1) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (uint32_t i = 0; i < pool->count; i++) { // Hand back whatever a deadline left unmarked
+        mark_worker *worker = &pool->workers[i];
+        for (size_t j = 0; j < worker->local_count; j++) grey_object(vm, worker->local[j]);
+        for (size_t j = 0; j < worker->shared_count; j++) grey_object(vm, worker->shared[j]);
+        worker->local_count = 0;
+        worker->shared_count = 0;
+    }
+    return vm->grey_count == 0;
+}
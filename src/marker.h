@@ -0,0 +1,50 @@
+#ifndef canidae_marker_h
+
+#define canidae_marker_h
+
+#include <pthread.h>
+#include "common.h"
+#include "value.h"
+
+#define MARKER_LOCAL_MAX 256 // Local grey entries a worker holds before sharing some with the others
+#define MARKER_SHARE_MIN 32 // Once its shared deque is empty, a worker shares work as soon as it holds this many
+
+typedef void (*blacken_function)(VM *vm, object *obj);
+
+typedef struct mark_worker {
+    struct marker_pool *pool;
+    pthread_t thread;
+    object **local; // Only ever touched by the owning thread
+    size_t local_count;
+    size_t local_capacity;
+    pthread_mutex_t lock; // Guards the shared deque, which other workers steal from
+    object **shared;
+    size_t shared_count;
+    size_t shared_capacity;
+} mark_worker;
+
+typedef struct marker_pool {
+    VM *vm;
+    uint32_t count; // Includes the collecting thread itself as worker 0
+    mark_worker *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t epoch; // Bumped to wake the helpers for a new trace
+    uint32_t finished;
+    uint8_t shutdown;
+    blacken_function blacken;
+    uint64_t deadline;
+    size_t min_work;
+    uint32_t active; // Workers that may still produce grey objects
+    uint8_t stop; // Set once the deadline passes, leaving what's left for the next step
+} marker_pool;
+
+extern _Thread_local mark_worker *current_marker;
+
+marker_pool *start_markers(VM *vm, uint32_t count);
+void stop_markers(marker_pool *pool);
+void marker_push(mark_worker *worker, object *obj);
+uint8_t parallel_trace(marker_pool *pool, blacken_function blacken, uint64_t deadline, size_t min_work);
+
+#endif
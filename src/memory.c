@@ -1,12 +1,12 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 #include "memory.h"
 #include "value.h"
 #include "object.h"
 #include "debug.h"
 #include "hashmap.h"
-
-#define GC_HEAP_GROW_FACTOR 2
+#include "marker.h"
 
 void *reallocate(VM *vm, void *ptr, size_t old_size, size_t new_size) {
     if (vm != NULL) {
@@ -19,6 +19,9 @@ void *reallocate(VM *vm, void *ptr, size_t old_size, size_t new_size) {
             collect_garbage(vm);
         }
     #endif
+    if (vm != NULL && vm->heap_limit != 0 && vm->bytes_allocated > vm->heap_limit && new_size > old_size) {
+        enforce_heap_limit(vm);
+    }
     
     if (new_size == 0) {
         free(ptr);
@@ -33,15 +36,23 @@ void *reallocate(VM *vm, void *ptr, size_t old_size, size_t new_size) {
     return result;
 }
 
-void mark_object(VM *vm, object *obj) {
-    if (obj == NULL || obj->is_marked) return;
-    #ifdef DEBUG_LOG_GC
-        printf("%p mark ", (void*)obj);
-        print_value(OBJ_VAL(obj));
-        printf("\n");
-    #endif
-    obj->is_marked = 1;
+void push_root(VM *vm, value *slot) { // Keeps *slot alive until the matching pop_roots - for natives that let the GC run
+    if (vm->root_count >= vm->root_capacity) {
+        vm->root_capacity = GROW_CAPACITY(vm->root_capacity);
+        vm->roots = realloc(vm->roots, sizeof(value*) * vm->root_capacity);
+        if (vm->roots == NULL) {
+            fprintf(stderr, "Failed to allocate memory, exiting...\n");
+            exit(1);
+        }
+    }
+    vm->roots[vm->root_count++] = slot;
+}
 
+void pop_roots(VM *vm, size_t count) {
+    vm->root_count -= count;
+}
+
+void grey_object(VM *vm, object *obj) {
     if (vm->grey_capacity < vm->grey_count + 1) {
         vm->grey_capacity = GROW_CAPACITY(vm->grey_capacity);
         vm->grey_stack = (object**)realloc(vm->grey_stack, sizeof(object*) * vm->grey_capacity);
@@ -51,11 +62,31 @@ void mark_object(VM *vm, object *obj) {
     vm->grey_stack[vm->grey_count++] = obj;
 }
 
+void mark_object(VM *vm, object *obj) {
+    if (obj == NULL) return;
+    // Frame-local objects can be released between marking steps, so they're left for the final remark
+    if (vm->gc_phase == GC_MARKING && (obj->flags & OBJ_FLAG_SCRATCH)) return;
+    if (current_marker != NULL) { // Parallel trace, so another worker may be racing to mark the same object
+        if (!try_mark(obj)) return;
+    }
+    else {
+        if (is_marked(obj)) return;
+        set_marked(obj);
+    }
+    #ifdef DEBUG_LOG_GC
+        printf("%p mark ", (void*)obj);
+        print_value(OBJ_VAL(obj));
+        printf("\n");
+    #endif
+    if (current_marker != NULL) marker_push(current_marker, obj);
+    else grey_object(vm, obj);
+}
+
 void mark_value(VM *vm, value val) {
     if (IS_OBJ(val)) mark_object(vm, AS_OBJ(val));
 }
 
-static void free_object(VM *vm, object *obj) {
+void free_object(VM *vm, object *obj) {
     #ifdef DEBUG_LOG_GC
         printf("%p free type %d", (void*) obj, obj->type);
         //print_value(OBJ_VAL(obj));
@@ -64,67 +95,60 @@ static void free_object(VM *vm, object *obj) {
     switch (obj->type) {
         case OBJ_STRING: {
             object_string *string = (object_string*) obj;
-            FREE_ARRAY(vm, char, string->chars, string->length+1);
-            FREE(vm, object_string, obj);
+            if (string->chars != NULL && !(string->string_flags & STRING_INLINE)) FREE_ARRAY(vm, char, string->chars, string->length+1); // Unflattened ropes have no characters of their own
             break;
         }
         case OBJ_ARRAY:{
             object_array *array = (object_array*) obj;
             destroy_value_array(vm, &array->arr);
-            FREE(vm, object_array, obj);
             break;
         }
         case OBJ_FUNCTION: {
             object_function *f = (object_function*)obj;
             destroy_segment(&f->seg);
-            FREE(vm, object_function, obj);
-            break;
-        }
-        case OBJ_NATIVE: {
-            FREE(vm, object_native, obj);
             break;
         }
         case OBJ_CLOSURE: {
             object_closure *closure = (object_closure*) obj;
             FREE_ARRAY(vm, object_upvalue*, closure->upvalues, closure->upvalue_count);
-            FREE(vm, object_closure, obj);
-            break;
-        }
-        case OBJ_UPVALUE: {
-            FREE(vm, object_upvalue, obj);
             break;
         }
         case OBJ_CLASS: {
             object_class *class_ = (object_class*) obj;
-            destroy_hashmap(&class_->methods, vm);
-            FREE(vm, object_class, obj);
+            destroy_hashmap(&class_->slots, vm);
+            FREE_ARRAY(vm, object_closure*, class_->vtable, class_->vtable_capacity);
             break;
         }
         case OBJ_INSTANCE: {
             object_instance *instance = (object_instance*) obj;
             destroy_hashmap(&instance->fields, vm);
-            FREE(vm, object_instance, obj);
-            break;
-        }
-        case OBJ_BOUND_METHOD: {
-            FREE(vm, object_bound_method, obj);
-            break;
-        }
-        case OBJ_BOUND_NATIVE: {
-            FREE(vm, object_bound_native, obj);
             break;
         }
         case OBJ_NAMESPACE: {
             object_namespace *namespace = (object_namespace*) obj;
             destroy_hashmap(&namespace->values, vm);
-            FREE(vm, object_namespace, obj);
             break;
         }
-        case OBJ_EXCEPTION: {
-            FREE(vm, object_exception, obj);
+        case OBJ_STRUCT: {
+            object_struct *type = (object_struct*) obj;
+            FREE_ARRAY(vm, object_string*, type->field_names, type->field_count);
+            destroy_hashmap(&type->field_slots, vm);
             break;
         }
+        case OBJ_BUILDER: {
+            object_builder *builder = (object_builder*) obj;
+            FREE_ARRAY(vm, char, builder->chars, builder->capacity);
+            break;
+        }
+        case OBJ_NATIVE:
+        case OBJ_UPVALUE:
+        case OBJ_BOUND_METHOD:
+        case OBJ_BOUND_NATIVE:
+        case OBJ_EXCEPTION:
+        case OBJ_RECORD: // Nothing owned outside the object itself
+            break;
     }
+    heap_free(vm, obj);
 }
 
 static void mark_roots(VM *vm) {
@@ -133,7 +157,7 @@ static void mark_roots(VM *vm) {
     }
     mark_hashmap(vm, &vm->globals); // Mark global variables
 
-    for (uint16_t i = 0; i < vm->frame_count; i++) { // Mark closures on call stack
+    for (uint32_t i = 0; i < vm->frame_count; i++) { // Mark closures on call stack
         mark_object(vm, (object*)vm->frames[i].closure);
     }
 
@@ -150,6 +174,7 @@ static void mark_roots(VM *vm) {
     mark_object(vm, (object*)vm->mult_string);
     mark_object(vm, (object*)vm->div_string);
     mark_object(vm, (object*)vm->pow_string);
+    mark_object(vm, (object*)vm->mod_string);
     mark_object(vm, (object*)vm->len_string);
     mark_object(vm, (object*)vm->message_string);
     mark_object(vm, (object*)vm->type_string);
@@ -157,7 +182,23 @@ static void mark_roots(VM *vm) {
     mark_object(vm, (object*)vm->push_string);
     mark_object(vm, (object*)vm->pop_string);
     mark_object(vm, (object*)vm->contains_string);
+    mark_object(vm, (object*)vm->append_string);
+    mark_object(vm, (object*)vm->build_string);
+    for (int i = 0; i < 256; i++) {
+        mark_object(vm, (object*)vm->char_strings[i]);
+    }
+    for (int i = 0; i < SMALL_INT_STRINGS; i++) {
+        mark_object(vm, (object*)vm->int_strings[i]);
+    }
     mark_object(vm, (object*)vm->exception_stack);
+
+    for (size_t i = 0; i < vm->scratch_count; i++) { // Mark frame-local objects (not on the objects list so sweep never sees them)
+        mark_object(vm, vm->scratch[i]);
+    }
+
+    for (size_t i = 0; i < vm->root_count; i++) { // Mark values held by natives
+        mark_value(vm, *vm->roots[i]);
+    }
 }
 
 static void mark_array(VM *vm, value_array *arr) {
@@ -198,7 +239,11 @@ static void blacken_object(VM *vm, object *obj) {
         case OBJ_CLASS: {
             object_class *class_ = (object_class*) obj;
             mark_object(vm, (object*) class_->name);
-            mark_hashmap(vm, &class_->methods);
+            mark_object(vm, (object*) class_->superclass);
+            mark_hashmap(vm, &class_->slots);
+            for (uint32_t i = 0; i < class_->method_count; i++) {
+                mark_object(vm, (object*) class_->vtable[i]);
+            }
             break;
         }
         case OBJ_INSTANCE: {
@@ -230,64 +275,404 @@ static void blacken_object(VM *vm, object *obj) {
             mark_object(vm, (object*) exception->next);
             break;
         }
+        case OBJ_STRUCT: {
+            object_struct *type = (object_struct*) obj;
+            mark_object(vm, (object*) type->name);
+            for (uint32_t i = 0; i < type->field_count; i++) {
+                mark_object(vm, (object*) type->field_names[i]);
+            }
+            mark_hashmap(vm, &type->field_slots);
+            break;
+        }
+        case OBJ_RECORD: {
+            object_record *record = (object_record*) obj;
+            mark_object(vm, (object*) record->type);
+            for (uint32_t i = 0; i < record->type->field_count; i++) {
+                mark_value(vm, record->fields[i]);
+            }
+            break;
+        }
+        case OBJ_STRING: {
+            if (((object_string*) obj)->string_flags & STRING_SLICE) mark_object(vm, (object*) ((object_slice*) obj)->parent);
+            if (!(((object_string*) obj)->string_flags & STRING_ROPE)) break;
+            object_rope *rope = (object_rope*) obj;
+            mark_object(vm, (object*) rope->left);
+            mark_object(vm, (object*) rope->right);
+            break;
+        }
         case OBJ_NATIVE:
-        case OBJ_STRING:
+        case OBJ_BUILDER:
             break;
     }
 }
 
+static marker_pool *markers(VM *vm) {
+    if (vm->markers == NULL) vm->markers = start_markers(vm, vm->gc_threads); // Threads are only started once they're needed
+    return vm->markers;
+}
+
 static void trace_references(VM *vm) {
+    if (vm->gc_threads > 1) {
+        parallel_trace(markers(vm), blacken_object, UINT64_MAX, 0);
+        return;
+    }
     while (vm->grey_count > 0) {
         object *obj = vm->grey_stack[--vm->grey_count];
         blacken_object(vm, obj);
     }
 }
 
-static void sweep(VM *vm) {
-    object *prev = NULL;
-    object *obj = vm->objects;
-    while (obj != NULL) {
-        if (obj->is_marked) {
-            obj->is_marked = 0;
-            prev = obj;
-            obj = obj->next;
+static void mark_remembered(VM *vm) {
+    // Remembered objects are old and so already marked - grey them directly so their young referents get traced
+    heap *h = &vm->heap;
+    for (size_t i = 0; i < h->remembered_count; i++) {
+        grey_object(vm, h->remembered[i]);
+    }
+}
+
+uint64_t gc_now_ns(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint8_t trace_until(VM *vm, uint64_t deadline) { // Returns whether the grey stack was emptied
+    if (vm->gc_threads > 1) return parallel_trace(markers(vm), blacken_object, deadline, GC_STEP_MIN_WORK);
+    size_t work = 0;
+    while (vm->grey_count > 0) {
+        for (uint32_t i = 0; i < GC_STEP_CHUNK && vm->grey_count > 0; i++) { // Only check the clock every so often
+            blacken_object(vm, vm->grey_stack[--vm->grey_count]);
+        }
+        work += GC_STEP_CHUNK;
+        if (work >= GC_STEP_MIN_WORK && gc_now_ns() >= deadline) break;
+    }
+    return vm->grey_count == 0;
+}
+
+static double adaptive_headroom(VM *vm, size_t survivors, double fallback) {
+    // Marking costs roughly the same however much headroom there is, but the program gets to run for longer between
+    // collections with more of it - so pick the headroom that puts the GC's share of the time at the target
+    gc_cycle *cycle = &vm->gc_cycle;
+    uint64_t elapsed = gc_now_ns() - cycle->start_ns;
+    size_t allocated = (vm->bytes_allocated - cycle->start_bytes) + (vm->gc_stats.bytes_freed - cycle->start_freed);
+    if (cycle->pause_ns == 0 || elapsed <= cycle->pause_ns || allocated == 0) return fallback; // Nothing to go on yet
+
+    double mutator_ns = (double) (elapsed - cycle->pause_ns);
+    double allocation_rate = allocated / mutator_ns; // Bytes per nanosecond of program time
+    double gc_ns = (double) cycle->pause_ns;
+    if (cycle->survivors > 0) gc_ns *= (double) survivors / cycle->survivors; // Tracing cost follows what survives
+    double target = vm->gc_config.target_percent / 100;
+    double headroom = allocation_rate * gc_ns * (1 - target) / target;
+
+    if (headroom < vm->gc_config.nursery_size) headroom = vm->gc_config.nursery_size;
+    if (headroom > (double) survivors * GC_ADAPTIVE_MAX_GROWTH) headroom = (double) survivors * GC_ADAPTIVE_MAX_GROWTH;
+    return headroom;
+}
+
+static size_t next_major_threshold(VM *vm, size_t survivors) {
+    gc_config *config = &vm->gc_config;
+    double threshold = survivors * config->growth_factor;
+    if (config->adaptive) threshold = survivors + adaptive_headroom(vm, survivors, threshold - survivors);
+    if (threshold < config->min_heap) threshold = config->min_heap;
+    if (config->max_heap != 0 && threshold > config->max_heap) threshold = config->max_heap;
+
+    gc_cycle *cycle = &vm->gc_cycle; // This major collection ends one cycle and starts the next
+    cycle->start_ns = gc_now_ns();
+    cycle->pause_ns = 0;
+    cycle->start_bytes = vm->bytes_allocated;
+    cycle->start_freed = vm->gc_stats.bytes_freed;
+    cycle->survivors = survivors;
+    return (size_t) threshold;
+}
+
+static void record_pause(VM *vm, uint64_t start) {
+    uint64_t pause = gc_now_ns() - start;
+    vm->gc_stats.total_pause_ns += pause;
+    if (pause > vm->gc_stats.max_pause_ns) vm->gc_stats.max_pause_ns = pause;
+    vm->gc_cycle.pause_ns += pause;
+}
+
+static void finish_collection(VM *vm, uint8_t major) {
+    size_t before = vm->bytes_allocated;
+    heap_forget_remembered(&vm->heap); // Everything the remembered set pointed at is now marked, so old too
+    if (vm->owns_strings) hashmap_remove_white(vm, &vm->strings);
+    heap_sweep(vm, major);
+    for (size_t i = 0; i < vm->scratch_count; i++) { // Sweep doesn't reset marks on frame-local objects so do it here
+        vm->scratch[i]->flags &= ~OBJ_FLAG_MARKED;
+    }
+    vm->gc_stats.bytes_freed += before - vm->bytes_allocated;
+
+    release_stack(vm); // Only ever decommits pages above the stack pointer, so nothing pointing into the stack moves
+
+    if (major) {
+        vm->major_threshold = next_major_threshold(vm, vm->bytes_allocated - vm->heap.pending_garbage); // Dead objects waiting to be swept don't count
+        vm->minors_since_major = 0;
+    }
+    else {
+        vm->minors_since_major++;
+    }
+    vm->gc_threshold = vm->bytes_allocated + vm->gc_config.nursery_size;
+}
+
+static void finish_major(VM *vm) {
+    // Roots aren't covered by the write barrier, so rescan them in one go before anything is swept
+    vm->gc_phase = GC_REMARK;
+    mark_roots(vm);
+    trace_references(vm);
+    finish_collection(vm, 1);
+    vm->gc_phase = GC_IDLE;
+    if (vm->gc_compact) vm->pending_work |= PENDING_COMPACTION; // Objects can't be moved from here, so the interpreter does it at its next safe point
+}
+
+#define FORWARD(field) ((field) = (void*) forwarded((object*) (field)))
+
+static void forward_array(value_array *arr) {
+    for (size_t i = 0; i < arr->len; i++) {
+        forward_value(&arr->values[i]);
+    }
+}
+
+static void forward_segment(segment *seg) {
+    forward_array(&seg->constants);
+    for (uint32_t i = 0; i < seg->switch_count; i++) { // String cases hold the interned strings directly
+        switch_table *t = &seg->switches[i];
+        if (t->cases == NULL) continue;
+        for (uint32_t j = 0; j < t->case_capacity; j++) forward_value(&t->cases[j].key);
+    }
+}
+
+static void forward_object(VM *vm, object *obj) { // Same edges as blacken_object, but updated rather than followed
+    switch (obj->type) {
+        case OBJ_UPVALUE: {
+            object_upvalue *upvalue = (object_upvalue*) obj;
+            forward_value(&upvalue->closed);
+            FORWARD(upvalue->next);
+            break;
+        }
+        case OBJ_FUNCTION: {
+            object_function *function = (object_function*) obj;
+            FORWARD(function->name);
+            forward_segment(&function->seg);
+            break;
+        }
+        case OBJ_CLOSURE: {
+            object_closure *closure = (object_closure*) obj;
+            FORWARD(closure->function);
+            for (uint32_t i = 0; i < closure->upvalue_count; i++) {
+                FORWARD(closure->upvalues[i]);
+            }
+            break;
+        }
+        case OBJ_ARRAY:
+            forward_array(&((object_array*) obj)->arr);
+            break;
+        case OBJ_CLASS: {
+            object_class *class_ = (object_class*) obj;
+            FORWARD(class_->name);
+            FORWARD(class_->superclass);
+            FORWARD(class_->initialiser);
+            hashmap_forward(&class_->slots);
+            for (uint32_t i = 0; i < class_->method_count; i++) {
+                FORWARD(class_->vtable[i]);
+            }
+            break;
+        }
+        case OBJ_INSTANCE: {
+            object_instance *instance = (object_instance*) obj;
+            FORWARD(instance->class_);
+            hashmap_forward(&instance->fields);
+            break;
+        }
+        case OBJ_BOUND_METHOD: {
+            object_bound_method *bound = (object_bound_method*) obj;
+            forward_value(&bound->receiver);
+            FORWARD(bound->method);
+            break;
         }
-        else {
-            object *unmarked = obj;
-            obj = obj->next;
-            if (prev != NULL) prev->next = obj;
-            else vm->objects = obj;
-            free_object(vm, unmarked);
+        case OBJ_BOUND_NATIVE:
+            forward_value(&((object_bound_native*) obj)->receiver);
+            break;
+        case OBJ_NAMESPACE: {
+            object_namespace *namespace = (object_namespace*) obj;
+            FORWARD(namespace->name);
+            hashmap_forward(&namespace->values);
+            break;
+        }
+        case OBJ_EXCEPTION: {
+            object_exception *exception = (object_exception*) obj;
+            FORWARD(exception->message);
+            FORWARD(exception->next);
+            break;
+        }
+        case OBJ_STRUCT: {
+            object_struct *type = (object_struct*) obj;
+            FORWARD(type->name);
+            for (uint32_t i = 0; i < type->field_count; i++) {
+                FORWARD(type->field_names[i]);
+            }
+            hashmap_forward(&type->field_slots);
+            break;
         }
+        case OBJ_RECORD: {
+            object_record *record = (object_record*) obj;
+            FORWARD(record->type); // Before the field count is read, as the old copy's fields are overwritten by the forwarding address
+            for (uint32_t i = 0; i < record->type->field_count; i++) {
+                forward_value(&record->fields[i]);
+            }
+            break;
+        }
+        case OBJ_STRING: {
+            object_string *string = (object_string*) obj;
+            if (string->string_flags & STRING_INLINE) string->chars = ((object_inline_string*) string)->chars; // Still pointing into the old copy
+            if (string->string_flags & STRING_SLICE) FORWARD(((object_slice*) string)->parent);
+            if (!(string->string_flags & STRING_ROPE)) break;
+            object_rope *rope = (object_rope*) obj;
+            FORWARD(rope->left);
+            FORWARD(rope->right);
+            break;
+        }
+        case OBJ_NATIVE:
+        case OBJ_BUILDER:
+            break;
     }
 }
 
+static void forward_roots(VM *vm) {
+    for (value *slot = vm->stack; slot < vm->stack_ptr; slot++) {
+        forward_value(slot);
+    }
+    hashmap_forward(&vm->globals);
+    hashmap_forward(&vm->strings);
+    for (uint32_t i = 0; i < vm->frame_count; i++) {
+        FORWARD(vm->frames[i].closure);
+    }
+    FORWARD(vm->open_upvalues);
+
+    FORWARD(vm->init_string);
+    FORWARD(vm->str_string);
+    FORWARD(vm->num_string);
+    FORWARD(vm->bool_string);
+    FORWARD(vm->add_string);
+    FORWARD(vm->sub_string);
+    FORWARD(vm->mult_string);
+    FORWARD(vm->div_string);
+    FORWARD(vm->pow_string);
+    FORWARD(vm->mod_string);
+    FORWARD(vm->len_string);
+    FORWARD(vm->message_string);
+    FORWARD(vm->type_string);
+    FORWARD(vm->push_string);
+    FORWARD(vm->pop_string);
+    FORWARD(vm->contains_string);
+    FORWARD(vm->append_string);
+    FORWARD(vm->build_string);
+    for (int i = 0; i < 256; i++) {
+        FORWARD(vm->char_strings[i]);
+    }
+    for (int i = 0; i < SMALL_INT_STRINGS; i++) {
+        FORWARD(vm->int_strings[i]);
+    }
+    FORWARD(vm->exception_stack);
+
+    for (size_t i = 0; i < vm->scratch_count; i++) { // Frame-local objects never move, but what they point at can
+        forward_object(vm, vm->scratch[i]);
+    }
+    for (size_t i = 0; i < vm->root_count; i++) {
+        forward_value(vm->roots[i]);
+    }
+}
+
+void compact_heap(VM *vm) {
+    // Only called between instructions, where every object pointer the interpreter holds is one the GC can see
+    vm->pending_work &= ~PENDING_COMPACTION;
+    if (vm->gc_phase != GC_IDLE || !vm->gc_allowed) return; // Asked again at the end of the next major collection
+    uint64_t start = gc_now_ns();
+    heap_finish_sweeping(vm);
+    heap_page *evacuated = heap_evacuate(vm);
+    if (evacuated != NULL) {
+        forward_roots(vm);
+        heap_visit_objects(vm, forward_object);
+        heap_forward_lists(&vm->heap);
+        vm->gc_stats.pages_compacted += heap_release_pages(evacuated);
+    }
+    record_pause(vm, start);
+}
+
+static void begin_major(VM *vm) {
+    vm->gc_stats.major_collections++;
+    vm->gc_stats.mark_steps++;
+    heap_finish_sweeping(vm); // Lazy sweeping relies on the last major's marks, so it has to be done before they go
+    heap_clear_marks(&vm->heap); // Marks are sticky between collections, so a major collection starts from scratch
+    heap_forget_remembered(&vm->heap);
+    vm->gc_phase = GC_MARKING;
+    mark_roots(vm);
+    heap_visit_arena(vm, grey_object); // Arena objects keep their marks for good, so they're traced like roots instead
+}
+
+static void collect_all_garbage(VM *vm) { // One uninterrupted major collection, swept straight away
+    if (vm->heap.arena) return;
+    uint64_t start = gc_now_ns();
+    if (vm->gc_phase == GC_MARKING) { // Anything the collection under way would free, a fresh one will too
+        trace_references(vm);
+        finish_major(vm);
+    }
+    begin_major(vm);
+    trace_references(vm);
+    finish_major(vm);
+    heap_finish_sweeping(vm);
+    record_pause(vm, start);
+}
+
+void enforce_heap_limit(VM *vm) {
+    if (vm->pending_work & PENDING_MEMORY_ERROR) return; // Already over, and the error just hasn't been raised yet
+    if (vm->gc_allowed) collect_all_garbage(vm);
+    // The allocation still has to go ahead, so the error is raised once the interpreter reaches a safe point
+    if (vm->bytes_allocated > vm->heap_limit) vm->pending_work |= PENDING_MEMORY_ERROR;
+}
+
+uint8_t heap_over_limit(VM *vm) {
+    // The program may have let go of memory between the limit being hit and the error being due
+    if (vm->gc_allowed) collect_all_garbage(vm);
+    return vm->bytes_allocated > vm->heap_limit;
+}
+
 void collect_garbage(VM *vm) {
-    if (!vm->gc_allowed) {
+    if (!vm->gc_allowed || vm->heap.arena) {
         return;
     }
+    uint64_t start = gc_now_ns();
     #ifdef DEBUG_LOG_GC
-        printf("-- gc begin\n");
         size_t before = vm->bytes_allocated;
     #endif
 
-    // Perform gc on heap values
-    mark_roots(vm);
-    trace_references(vm);
-    if (vm->owns_strings) hashmap_remove_white(vm, &vm->strings);
-    sweep(vm);
-
-    // Consider shrinking stack if it's particularly oversized
-    size_t stack_length = STACK_LEN(vm);
-    if (vm->stack_capacity >= STACK_INITIAL*2 && stack_length*4 < vm->stack_capacity) {
-        size_t oldc = vm->stack_capacity;
-        resize_stack(vm, vm->stack_capacity/2);
+    if (vm->gc_phase == GC_MARKING) { // Major collection already under way, so do another slice of it
+        #ifdef DEBUG_LOG_GC
+            printf("-- gc step\n");
+        #endif
+        vm->gc_stats.mark_steps++;
+        if (trace_until(vm, start + vm->gc_step_budget)) finish_major(vm);
+        else vm->gc_threshold = vm->bytes_allocated + GC_STEP_SIZE;
+    }
+    else if (vm->bytes_allocated > vm->major_threshold || vm->minors_since_major >= GC_MAX_MINOR_COLLECTIONS) {
         #ifdef DEBUG_LOG_GC
-            printf("shrunk VM stack by %zu bytes (from %zu to %zu)\n", (oldc - vm->stack_capacity)*sizeof(value), oldc*sizeof(value), vm->stack_capacity*sizeof(value));
+            printf("-- gc begin (major)\n");
         #endif
+        begin_major(vm);
+        if (trace_until(vm, start + vm->gc_step_budget)) finish_major(vm);
+        else vm->gc_threshold = vm->bytes_allocated + GC_STEP_SIZE;
+    }
+    else {
+        #ifdef DEBUG_LOG_GC
+            printf("-- gc begin (minor)\n");
+        #endif
+        vm->gc_stats.minor_collections++;
+        mark_roots(vm);
+        mark_remembered(vm);
+        trace_references(vm);
+        finish_collection(vm, 0);
     }
 
-    vm->gc_threshold = vm->bytes_allocated * GC_HEAP_GROW_FACTOR;
+    record_pause(vm, start);
 
     #ifdef DEBUG_LOG_GC
         printf("-- gc end\n");
@@ -295,12 +680,3 @@ void collect_garbage(VM *vm) {
             before - vm->bytes_allocated, before, vm->bytes_allocated, vm->gc_threshold);
     #endif
 }
-
-void free_objects(VM *vm, object *objects) {
-    object *obj = objects;
-    while (obj != NULL) {
-        object *next = obj->next;
-        free_object(vm, obj);
-        obj = next;
-    }
-}
\ No newline at end of file
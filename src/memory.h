@@ -19,10 +19,63 @@
 #define ALLOCATE(vm, type, count) \
     (type*)reallocate(vm, NULL, 0, sizeof(type) * (count))
 
+static inline int is_marked(object *obj) {
+    if (obj->flags & OBJ_FLAG_OFF_PAGE) return (obj->flags & OBJ_FLAG_MARKED) != 0;
+    heap_page *page = page_of(obj);
+    uint32_t index = slot_index(page, obj);
+    return (page->mark_bits[index >> 6] >> (index & 63)) & 1;
+}
+
+static inline void set_marked(object *obj) {
+    if (obj->flags & OBJ_FLAG_OFF_PAGE) {
+        obj->flags |= OBJ_FLAG_MARKED;
+        return;
+    }
+    heap_page *page = page_of(obj);
+    uint32_t index = slot_index(page, obj);
+    page->mark_bits[index >> 6] |= (uint64_t) 1 << (index & 63);
+}
+
 void *reallocate(VM *vm, void *ptr, size_t old_size, size_t new_size);
 void mark_value(VM *vm, value val);
 void mark_object(VM *vm, object *obj);
+void grey_object(VM *vm, object *obj);
+uint64_t gc_now_ns(void);
 void collect_garbage(VM *vm);
-void free_objects(VM *vm, object *objects);
+void compact_heap(VM *vm);
+void push_root(VM *vm, value *slot);
+void pop_roots(VM *vm, size_t count);
+void enforce_heap_limit(VM *vm);
+uint8_t heap_over_limit(VM *vm);
+void free_object(VM *vm, object *obj);
+
+static inline int try_mark(object *obj) { // Atomic test-and-set, for when several markers may race on one object
+    if (obj->flags & OBJ_FLAG_OFF_PAGE) return (__atomic_fetch_or(&obj->flags, OBJ_FLAG_MARKED, __ATOMIC_RELAXED) & OBJ_FLAG_MARKED) == 0;
+    heap_page *page = page_of(obj);
+    uint32_t index = slot_index(page, obj);
+    uint64_t bit = (uint64_t) 1 << (index & 63);
+    return (__atomic_fetch_or(&page->mark_bits[index >> 6], bit, __ATOMIC_RELAXED) & bit) == 0;
+}
+
+static inline object *forwarded(object *obj) { // Where compaction moved obj to, or obj itself if it hasn't moved
+    if (obj == NULL || !(obj->flags & OBJ_FLAG_FORWARDED)) return obj;
+    return ((object**) obj)[1];
+}
+
+static inline void forward_value(value *val) {
+    if (IS_OBJ(*val)) *val = OBJ_VAL(forwarded(AS_OBJ(*val)));
+}
+
+static inline void write_barrier(VM *vm, object *owner, value val) {
+    if (!IS_OBJ(val)) return;
+    if (vm->gc_phase == GC_MARKING) { // Shade the new referent so no marked object ever points at an unmarked one
+        mark_object(vm, AS_OBJ(val));
+        return;
+    }
+    // Minor collections don't trace old objects, so an old object pointing at a young one has to be remembered
+    if (!(owner->flags & OBJ_FLAG_REMEMBERED) && is_marked(owner) && !is_marked(AS_OBJ(val))) {
+        heap_remember(&vm->heap, owner);
+    }
+}
 
 #endif
\ No newline at end of file
@@ -1,4 +1,6 @@
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "memory.h"
 #include "object.h"
@@ -9,11 +11,8 @@
     (type*) allocate_object(vm, sizeof(type), obj_type);
 
 static object *allocate_object(VM* vm, size_t size, object_type type) {
-    object *obj = reallocate(vm, NULL, 0, size);
-    obj->is_marked = 0;
+    object *obj = heap_allocate(vm, size);
     obj->type = type;
-    obj->next = vm->objects;
-    vm->objects = obj;
 
     #ifdef DEBUG_LOG_GC
         printf("%p allocate %zu for %d\n", (void*) obj, size, type);
@@ -22,6 +21,24 @@ static object *allocate_object(VM* vm, size_t size, object_type type) {
     return obj;
 }
 
+static object *allocate_scratch_object(VM *vm, size_t size, object_type type) {
+    // Frame-local objects live outside the heap pages - the VM frees them itself when their scope or frame ends
+    if (vm->scratch_count >= vm->scratch_capacity) { // Grown first, as growing it can collect and the new object isn't listed yet
+        size_t oldc = vm->scratch_capacity;
+        vm->scratch_capacity = GROW_CAPACITY(oldc);
+        vm->scratch = GROW_ARRAY(vm, object*, vm->scratch, oldc, vm->scratch_capacity);
+    }
+    object *obj = heap_allocate_scratch(vm, size);
+    obj->type = type;
+    vm->scratch[vm->scratch_count++] = obj;
+
+    #ifdef DEBUG_LOG_GC
+        printf("%p allocate scratch %zu for %d\n", (void*) obj, size, type);
+    #endif
+
+    return obj;
+}
+
 object_function *new_function(VM *vm) {
     object_function *f = ALLOCATE_OBJ(vm, object_function, OBJ_FUNCTION);
     f->arity = 0;
@@ -42,9 +59,22 @@ object_closure *new_closure(VM *vm, object_function *function) {
     return closure;
 }
 
+object_closure *new_scratch_closure(VM *vm, object_function *function) {
+    object_upvalue **upvalues = ALLOCATE(vm, object_upvalue*, function->upvalue_count);
+    for (uint32_t i = 0; i < function->upvalue_count; i++) {
+        upvalues[i] = NULL;
+    }
+    object_closure *closure = (object_closure*) allocate_scratch_object(vm, sizeof(object_closure), OBJ_CLOSURE);
+    closure->function = function;
+    closure->upvalues = upvalues;
+    closure->upvalue_count = function->upvalue_count;
+    return closure;
+}
+
 object_native *new_native(VM *vm, native_function function) {
     object_native *n = ALLOCATE_OBJ(vm, object_native, OBJ_NATIVE);
     n->function = function;
+    n->gc_safe = 0;
     return n;
 }
 
@@ -58,11 +88,37 @@ object_upvalue *new_upvalue(VM *vm, value *slot) {
 
 object_class *new_class(VM *vm, object_string *name) {
     object_class *class_ = ALLOCATE_OBJ(vm, object_class, OBJ_CLASS);
+    static _Atomic uint32_t next_class_id = 0; // Shared across VMs since classes from imported modules end up in the importing VM, which may be on other threads
     class_->name = name;
-    init_hashmap(&class_->methods);
+    class_->superclass = NULL;
+    init_hashmap(&class_->slots);
+    class_->vtable = NULL;
+    class_->method_count = 0;
+    class_->vtable_capacity = 0;
+    class_->initialiser = NULL;
+    uint32_t id;
+    do id = atomic_fetch_add(&next_class_id, 1) + 1; while (id == 0); // 0 marks an empty cache
+    class_->id = id;
     return class_;
 }
 
+uint8_t find_method_slot(object_class *class_, object_string *name, uint32_t *slot) {
+    for (object_class *c = class_; c != NULL; c = c->superclass) { // Each name lives in the slots of the class that introduced it
+        value v;
+        if (hashmap_get(&c->slots, name, &v)) {
+            *slot = (uint32_t) AS_NUMBER(v);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+object_closure *find_method(object_class *class_, object_string *name) {
+    uint32_t slot;
+    if (!find_method_slot(class_, name, &slot)) return NULL;
+    return class_->vtable[slot];
+}
+
 object_instance *new_instance(VM *vm, object_class *class_) {
     object_instance *instance = ALLOCATE_OBJ(vm, object_instance, OBJ_INSTANCE);
     instance->class_ = class_;
@@ -93,9 +149,10 @@ object_namespace *new_namespace(VM *vm, object_string *name, hashmap *source) {
 }
 
 object_exception *new_exception(VM *vm, object_string *message, error_type type, size_t line) {
-    push(vm, OBJ_VAL(message));
+    value root = OBJ_VAL(message); // Rooted off the value stack, which may be full when the exception is for overflowing it
+    push_root(vm, &root);
     object_exception *exception = ALLOCATE_OBJ(vm, object_exception, OBJ_EXCEPTION);
-    pop(vm);
+    pop_roots(vm, 1);
     exception->message = message;
     exception->type = type;
     exception->next = NULL;
@@ -103,14 +160,35 @@ object_exception *new_exception(VM *vm, object_string *message, error_type type,
     return exception;
 }
 
-static object_string *allocate_string(VM *vm, char *chars, size_t length, uint32_t hash) {
+#define STRING_INLINE_MAX (HEAP_MAX_SLOT - sizeof(object_inline_string) - 1) // Longest string whose characters fit in its own slot
+
+static object_string *allocate_inline_string(VM *vm, const char *chars, size_t length) {
+    object_inline_string *string = (object_inline_string*) allocate_object(vm, sizeof(object_inline_string) + length + 1, OBJ_STRING);
+    memcpy(string->chars, chars, length);
+    string->chars[length] = '\0';
+    string->str.string_flags = STRING_INLINE;
+    string->str.hash = 0;
+    string->str.length = length;
+    string->str.chars = string->chars;
+    return (object_string*) string;
+}
+
+static object_string *adopt_string(VM *vm, char *chars, size_t length) { // Takes ownership of chars, which has to be from ALLOCATE
     object_string *string = ALLOCATE_OBJ(vm, object_string, OBJ_STRING);
+    string->string_flags = 0;
+    string->hash = 0;
     string->length = length;
     string->chars = chars;
+    return string;
+}
+
+static object_string *intern_string(VM *vm, object_string *string, uint32_t hash) {
+    string->string_flags |= STRING_INTERNED | STRING_HASHED;
     string->hash = hash;
-    push(vm, OBJ_VAL(string));
+    value root = OBJ_VAL(string);
+    push_root(vm, &root);
     hashmap_set(&vm->strings, vm, string, NULL_VAL);
-    pop(vm);
+    pop_roots(vm, 1);
     return string;
 }
 
@@ -123,24 +201,83 @@ static uint32_t hash_string(const char *key, size_t length) {
     return hash;
 }
 
-object_string *take_string(VM *vm, char *chars, size_t length) {
-    uint32_t hash = hash_string(chars, length);
-    object_string *interned = hashmap_find_string(&vm->strings, chars, length, hash);
-    if (interned != NULL) {
-        FREE_ARRAY(NULL, char, chars, length + 1);
-        return interned;
+object_struct *new_struct(VM *vm, object_string *name, object_string **field_names, uint32_t field_count) {
+    object_struct *type = ALLOCATE_OBJ(vm, object_struct, OBJ_STRUCT);
+    type->name = name;
+    type->field_count = 0;
+    type->field_names = NULL;
+    init_hashmap(&type->field_slots);
+    if (field_count > 0) type->field_names = ALLOCATE(vm, object_string*, field_count);
+    for (uint32_t i = 0; i < field_count; i++) {
+        type->field_names[i] = field_names[i];
+        hashmap_set(&type->field_slots, vm, field_names[i], NUMBER_VAL((double) i));
+        type->field_count++; // Only count fields once they're in place in case setting the slot triggers gc
+    }
+    return type;
+}
+
+object_record *new_record(VM *vm, object_struct *type, value *fields) {
+    object_record *record = (object_record*) allocate_object(vm, sizeof(object_record) + type->field_count * sizeof(value), OBJ_RECORD);
+    record->type = type;
+    memcpy(record->fields, fields, type->field_count * sizeof(value));
+    return record;
+}
+
+long struct_field_slot(object_struct *type, object_string *name) {
+    value v;
+    if (!hashmap_get(&type->field_slots, name, &v)) return -1;
+    return (long) AS_NUMBER(v);
+}
+
+object_builder *new_builder(VM *vm) {
+    object_builder *builder = ALLOCATE_OBJ(vm, object_builder, OBJ_BUILDER);
+    builder->length = 0;
+    builder->capacity = 0;
+    builder->chars = NULL;
+    return builder;
+}
+
+void builder_append(VM *vm, object_builder *builder, object_string *string) { // Both have to be reachable, as growing the buffer can collect
+    if (builder->length + string->length > builder->capacity) {
+        size_t old_capacity = builder->capacity;
+        while (builder->capacity < builder->length + string->length) builder->capacity = GROW_CAPACITY(builder->capacity);
+        builder->chars = GROW_ARRAY(vm, char, builder->chars, old_capacity, builder->capacity);
+    }
+    write_string_chars(string, builder->chars + builder->length);
+    builder->length += string->length;
+}
+
+object_string *builder_to_string(VM *vm, object_builder *builder) { // Copies, so the builder can carry on being appended to
+    char *chars = ALLOCATE(vm, char, builder->length + 1);
+    if (builder->length > 0) memcpy(chars, builder->chars, builder->length);
+    chars[builder->length] = '\0';
+    return take_string(vm, chars, builder->length);
+}
+
+object_string *take_string(VM *vm, char *chars, size_t length) { // For strings made at run time - identifiers and literals go through copy_string
+    if (length > STRING_INLINE_MAX) return adopt_string(vm, chars, length); // Too long to be worth copying, hashing or interning
+    object_string *string;
+    if (length > STRING_INTERN_MAX) { // Not worth walking just to intern, and rarely compared
+        string = allocate_inline_string(vm, chars, length);
+        FREE_ARRAY(vm, char, chars, length + 1);
+        return string;
     }
-    return allocate_string(vm, chars, length, hash);
+    uint32_t hash = hash_string(chars, length);
+    string = hashmap_find_string(&vm->strings, chars, length, hash);
+    if (string == NULL) string = intern_string(vm, allocate_inline_string(vm, chars, length), hash);
+    FREE_ARRAY(vm, char, chars, length + 1);
+    return string;
 }
 
 object_string *copy_string(VM *vm, const char *chars, size_t length) {
     uint32_t hash = hash_string(chars, length);
     object_string *interned = hashmap_find_string(&vm->strings, chars, length, hash);
     if (interned != NULL) return interned;
+    if (length <= STRING_INLINE_MAX) return intern_string(vm, allocate_inline_string(vm, chars, length), hash);
     char *new_string = ALLOCATE(vm, char, length + 1);
     memcpy(new_string, chars, length);
     new_string[length] = '\0';
-    return allocate_string(vm, new_string, length, hash);
+    return intern_string(vm, adopt_string(vm, new_string, length), hash);
 }
 
 static void print_function(object_function *f) {
@@ -154,7 +291,8 @@ static void print_function(object_function *f) {
 
 object_array *allocate_array(VM *vm, value *values, size_t length) {
     object_array *array = ALLOCATE_OBJ(vm, object_array, OBJ_ARRAY);
-    push(vm, OBJ_VAL(array));
+    value root = OBJ_VAL(array);
+    push_root(vm, &root);
     init_value_array(&array->arr);
     array->arr.values = values;
     array->arr.len = length;
@@ -165,7 +303,17 @@ object_array *allocate_array(VM *vm, value *values, size_t length) {
     }
     array->arr.values = GROW_ARRAY(vm, value, array->arr.values, length, pow);
     array->arr.capacity = pow;
-    pop(vm);
+    pop_roots(vm, 1);
+    return array;
+}
+
+object_array *allocate_scratch_array(VM *vm, value *values, size_t length) {
+    // Scratch arrays are sized exactly - they're usually small fixed tuples that never grow
+    object_array *array = (object_array*) allocate_scratch_object(vm, sizeof(object_array), OBJ_ARRAY);
+    init_value_array(&array->arr);
+    array->arr.values = values;
+    array->arr.len = length;
+    array->arr.capacity = length;
     return array;
 }
 
@@ -180,12 +328,160 @@ void array_set(VM *vm, object_array *arr, size_t index, value val) {
         }
     }
     arr->arr.values[index] = val;
+    write_barrier(vm, (object*) arr, val);
     if (arr->arr.len < index+1) {
         arr->arr.len = index+1;
     }
 }
 
-int8_t string_comparison(object_string *a, object_string *b) {
+typedef struct { // Walks the flat pieces of a rope left to right, without flattening it
+    object_string **stack;
+    size_t count;
+    size_t capacity;
+} leaf_cursor;
+
+static void push_leaf(leaf_cursor *c, object_string *string) {
+    if (c->count == c->capacity) {
+        c->capacity = GROW_CAPACITY(c->capacity);
+        c->stack = realloc(c->stack, sizeof(object_string*) * c->capacity);
+        if (c->stack == NULL) {
+            fprintf(stderr, "Failed to allocate memory, exiting...\n");
+            exit(1);
+        }
+    }
+    c->stack[c->count++] = string;
+}
+
+static object_string *next_leaf(leaf_cursor *c) { // Leaves are flat strings or views, so read them with leaf_chars
+    while (c->count > 0) {
+        object_string *string = c->stack[--c->count];
+        if (string->chars != NULL || (string->string_flags & STRING_SLICE)) return string; // Flat, a view, or a rope that has already been flattened
+        object_rope *rope = (object_rope*) string;
+        push_leaf(c, rope->right);
+        push_leaf(c, rope->left);
+    }
+    return NULL;
+}
+
+object_string *concatenate_strings(VM *vm, object_string *a, object_string *b) { // Both have to be reachable, as this allocates
+    if (a->length == 0) return b;
+    if (b->length == 0) return a;
+    size_t length = a->length + b->length;
+    if (length < ROPE_MIN_LENGTH) { // Neither half can be a rope, as ropes are never this short
+        char chars[ROPE_MIN_LENGTH];
+        memcpy(chars, a->chars, a->length);
+        memcpy(chars + a->length, b->chars, b->length);
+        return copy_string(vm, chars, length);
+    }
+    object_rope *rope = ALLOCATE_OBJ(vm, object_rope, OBJ_STRING);
+    rope->str.string_flags = STRING_ROPE;
+    rope->str.hash = 0;
+    rope->str.length = length;
+    rope->str.chars = NULL;
+    rope->left = a;
+    rope->right = b;
+    return (object_string*) rope;
+}
+
+static const char *leaf_chars(object_string *leaf) {
+    if (leaf->chars != NULL) return leaf->chars;
+    object_slice *slice = (object_slice*) leaf;
+    return slice->parent->chars + slice->offset;
+}
+
+object_string *slice_string(VM *vm, object_string *string, size_t start, size_t length) { // The string has to be reachable, as this allocates
+    if (start == 0 && length == string->length) return string;
+    if (string->chars == NULL && (string->string_flags & STRING_SLICE)) { // View the parent directly rather than chaining views
+        object_slice *view = (object_slice*) string;
+        start += view->offset;
+        string = view->parent;
+    }
+    flatten_string(vm, string);
+    if (length < ROPE_MIN_LENGTH) return copy_string(vm, string->chars + start, length); // Short pieces are cheaper to copy, and get interned
+    object_slice *slice = ALLOCATE_OBJ(vm, object_slice, OBJ_STRING);
+    slice->str.string_flags = STRING_SLICE;
+    slice->str.hash = 0;
+    slice->str.length = length;
+    slice->str.chars = NULL;
+    slice->parent = string;
+    slice->offset = start;
+    return (object_string*) slice;
+}
+
+void write_string_chars(object_string *string, char *dest) { // Copies out the characters of any string, without flattening it
+    if (string->chars != NULL) {
+        memcpy(dest, string->chars, string->length);
+        return;
+    }
+    leaf_cursor c = {NULL, 0, 0};
+    push_leaf(&c, string);
+    object_string *leaf;
+    while ((leaf = next_leaf(&c)) != NULL) {
+        memcpy(dest, leaf_chars(leaf), leaf->length);
+        dest += leaf->length;
+    }
+    free(c.stack);
+}
+
+void flatten_string(VM *vm, object_string *string) { // The string has to be reachable, as this allocates
+    if (string->chars != NULL) return;
+    char *chars = ALLOCATE(vm, char, string->length + 1);
+    write_string_chars(string, chars);
+    chars[string->length] = '\0';
+    string->chars = chars; // Left unhashed, as most flattened strings are never hashed
+    if (string->string_flags & STRING_SLICE) { // Let the pieces go
+        ((object_slice*) string)->parent = NULL;
+    } else {
+        ((object_rope*) string)->left = NULL;
+        ((object_rope*) string)->right = NULL;
+    }
+}
+
+uint32_t string_hash(object_string *string) { // The string has to be flat
+    if (!(string->string_flags & STRING_HASHED)) {
+        string->hash = hash_string(string->chars, string->length);
+        string->string_flags |= STRING_HASHED;
+    }
+    return string->hash;
+}
+
+uint8_t string_equality(object_string *a, object_string *b) {
+    if (a == b) return 1;
+    if (a->length != b->length || (a->string_flags & b->string_flags & STRING_INTERNED)) return 0; // Different interned strings never match
+    if ((a->string_flags & b->string_flags & STRING_HASHED) && a->hash != b->hash) return 0;
+    if (a->chars != NULL && b->chars != NULL) return memcmp(a->chars, b->chars, a->length) == 0;
+    leaf_cursor ca = {NULL, 0, 0};
+    leaf_cursor cb = {NULL, 0, 0};
+    push_leaf(&ca, a);
+    push_leaf(&cb, b);
+    object_string *la = next_leaf(&ca);
+    object_string *lb = next_leaf(&cb);
+    size_t oa = 0;
+    size_t ob = 0;
+    uint8_t equal = 1;
+    while (la != NULL && lb != NULL) {
+        size_t n = la->length - oa < lb->length - ob ? la->length - oa : lb->length - ob;
+        if (memcmp(leaf_chars(la) + oa, leaf_chars(lb) + ob, n) != 0) {
+            equal = 0;
+            break;
+        }
+        oa += n;
+        ob += n;
+        if (oa == la->length) {
+            la = next_leaf(&ca);
+            oa = 0;
+        }
+        if (ob == lb->length) {
+            lb = next_leaf(&cb);
+            ob = 0;
+        }
+    }
+    free(ca.stack);
+    free(cb.stack);
+    return equal;
+}
+
+int8_t string_comparison(object_string *a, object_string *b) { // Both have to be flat
     if (a == b) return 0;
     size_t str_len;
     uint8_t a_is_shorter = a->length < b->length;
@@ -193,6 +489,7 @@ int8_t string_comparison(object_string *a, object_string *b) {
     else str_len = b->length;
     int8_t result = strncmp(a->chars, b->chars, str_len);
     if (result == 0) {
+        if (a->length == b->length) return 0; // Only for a rope with the same contents as another string
         if (a_is_shorter) return -1;
         else return 1; 
     }
@@ -209,10 +506,22 @@ uint8_t array_equality(object_array *a, object_array *b) {
     else return 0;
 }
 
+void print_string(object_string *string, FILE *stream) {
+    if (string->chars != NULL) {
+        fwrite(string->chars, 1, string->length, stream);
+        return;
+    }
+    leaf_cursor c = {NULL, 0, 0}; // Printing a rope doesn't need it flattened
+    push_leaf(&c, string);
+    object_string *leaf;
+    while ((leaf = next_leaf(&c)) != NULL) fwrite(leaf_chars(leaf), 1, leaf->length, stream);
+    free(c.stack);
+}
+
 void print_object(value v) {
     switch (GET_OBJ_TYPE(v)) {
         case OBJ_STRING:
-            printf("%s", AS_CSTRING(v));
+            print_string(AS_STRING(v), stdout);
             break;
         case OBJ_ARRAY:
             printf("[");
@@ -259,6 +568,15 @@ void print_object(value v) {
             printf("<exception %s>", error_strings[AS_EXCEPTION(v)->type]);
             break;
         }
+        case OBJ_STRUCT:
+            printf("<struct %s>", AS_STRUCT(v)->name->chars);
+            break;
+        case OBJ_RECORD:
+            printf("<%s record at %p>", AS_RECORD(v)->type->name->chars, (void*) AS_OBJ(v));
+            break;
+        case OBJ_BUILDER:
+            printf("<string builder>");
+            break;
         default:
             break;
     }
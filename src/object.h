@@ -2,6 +2,7 @@
 
 #define canidae_object_h
 
+#include <stdio.h>
 #include "common.h"
 #include "value.h"
 #include "segment.h"
@@ -19,12 +20,16 @@
 #define IS_BOUND_NATIVE(v) is_obj_type(v, OBJ_BOUND_NATIVE)
 #define IS_NAMESPACE(v) is_obj_type(v, OBJ_NAMESPACE)
 #define IS_EXCEPTION(v) is_obj_type(v, OBJ_EXCEPTION)
+#define IS_STRUCT(v) is_obj_type(v, OBJ_STRUCT)
+#define IS_RECORD(v) is_obj_type(v, OBJ_RECORD)
+#define IS_BUILDER(v) is_obj_type(v, OBJ_BUILDER)
 
 #define AS_ARRAY(v) ((object_array*)AS_OBJ(v))
 #define AS_STRING(v) ((object_string*)AS_OBJ(v))
 #define AS_CSTRING(v) (((object_string*)AS_OBJ(v))->chars)
 #define AS_FUNCTION(v) ((object_function*)AS_OBJ(v))
 #define AS_NATIVE(v) (((object_native*)AS_OBJ(v))->function)
+#define AS_NATIVE_OBJ(v) ((object_native*)AS_OBJ(v))
 #define AS_CLOSURE(v) ((object_closure*)AS_OBJ(v))
 #define AS_CLASS(v) ((object_class*)AS_OBJ(v))
 #define AS_INSTANCE(v) ((object_instance*) AS_OBJ(v))
@@ -32,6 +37,9 @@
 #define AS_BOUND_NATIVE(v) ((object_bound_native*) AS_OBJ(v))
 #define AS_NAMESPACE(v) ((object_namespace*) AS_OBJ(v))
 #define AS_EXCEPTION(v) ((object_exception*) AS_OBJ(v))
+#define AS_STRUCT(v) ((object_struct*) AS_OBJ(v))
+#define AS_RECORD(v) ((object_record*) AS_OBJ(v))
+#define AS_BUILDER(v) ((object_builder*) AS_OBJ(v))
 
 typedef enum {
     OBJ_STRING,
@@ -46,19 +54,23 @@ typedef enum {
     OBJ_BOUND_NATIVE,
     OBJ_NAMESPACE,
     OBJ_EXCEPTION,
+    OBJ_STRUCT,
+    OBJ_RECORD,
+    OBJ_BUILDER,
 } object_type;
 
 typedef value (*native_function)(VM *vm, uint8_t argc, value *argv);
 typedef value (*bound_native_function)(VM *vm, value receiver, uint8_t argc, value *argv);
 
+// Two bytes, so each object type packs its own small fields into the rest of the first word
 struct object {
-    object_type type;
-    uint8_t is_marked;
-    struct object *next;
+    uint8_t type; // An object_type
+    uint8_t flags; // OBJ_FLAG_* from heap.h
 };
 
 struct object_native {
     object obj;
+    uint8_t gc_safe; // Roots its own temporaries (push_root), so the GC can run while it does
     native_function function;
 };
 
@@ -72,9 +84,9 @@ struct object_function {
 
 struct object_closure {
     object obj;
+    uint32_t upvalue_count;
     object_function *function;
     object_upvalue **upvalues;
-    uint32_t upvalue_count;
 };
 
 struct object_upvalue {
@@ -84,13 +96,40 @@ struct object_upvalue {
     object_upvalue *next;
 };
 
+#define ROPE_MIN_LENGTH 128 // Concatenations at least this long build a rope rather than copying both halves
+#define STRING_INTERN_MAX 256 // Longer strings made at run time skip the intern table, and only hash themselves when asked to
+
+#define STRING_ROPE 0x1 // Allocated as an object_rope, chars is only set once it's flattened
+#define STRING_INTERNED 0x2 // In vm->strings, so no other string has the same contents
+#define STRING_HASHED 0x4
+#define STRING_INLINE 0x8 // Allocated as an object_inline_string, chars points at its own tail
+#define STRING_SLICE 0x10 // Allocated as an object_slice, chars is only set once it's materialised
+
 struct object_string {
     object obj;
+    uint8_t string_flags;
+    uint32_t hash; // Only valid with STRING_HASHED - see string_hash
     size_t length;
     char *chars;
-    uint32_t hash;
 };
 
+typedef struct {
+    object_string str;
+    char chars[]; // Strings short enough to fit a heap slot keep their characters here, saving a second allocation
+} object_inline_string;
+
+typedef struct {
+    object_string str;
+    object_string *left; // Both NULL once flattened
+    object_string *right;
+} object_rope;
+
+typedef struct {
+    object_string str;
+    object_string *parent; // Always flat, and kept alive by the view - NULL once materialised
+    size_t offset;
+} object_slice;
+
 struct object_array {
     object obj;
     value_array arr;
@@ -98,8 +137,14 @@ struct object_array {
 
 struct object_class {
     object obj;
+    uint32_t id; // Unique per class so inline caches in bytecode can check they're still valid
     object_string *name;
-    hashmap methods;
+    object_class *superclass;
+    hashmap slots; // Maps method names introduced by this class to vtable slots - inherited names are found through the superclass
+    object_closure **vtable; // Methods indexed by slot, overrides reuse the slot of the method they override
+    uint32_t method_count;
+    uint32_t vtable_capacity;
+    object_closure *initialiser;
 };
 
 struct object_instance {
@@ -128,30 +173,68 @@ struct object_namespace {
 
 struct object_exception {
     object obj;
-    object_string *message;
     error_type type;
+    object_string *message;
     size_t line;
     object_exception *next;
 };
 
+struct object_struct {
+    object obj;
+    uint32_t field_count;
+    object_string *name;
+    object_string **field_names; // Field names in slot order
+    hashmap field_slots; // Field name to slot, for accesses the compiler couldn't resolve to a slot
+};
+
+struct object_record {
+    object obj;
+    object_struct *type;
+    value fields[]; // Laid out inline after the header, one per field of the struct
+};
+
+struct object_builder {
+    object obj;
+    size_t length;
+    size_t capacity;
+    char *chars; // Not NUL terminated - build copies it out into a string
+};
+
 object_native *new_native(VM *vm, native_function function);
 object_function *new_function(VM *vm);
 object_closure *new_closure(VM *vm, object_function *function);
+object_closure *new_scratch_closure(VM *vm, object_function *function);
 object_upvalue *new_upvalue(VM *vm, value *slot);
 object_class *new_class(VM *vm, object_string *name);
 object_instance *new_instance(VM *vm, object_class *class_);
+uint8_t find_method_slot(object_class *class_, object_string *name, uint32_t *slot);
+object_closure *find_method(object_class *class_, object_string *name);
 object_bound_method *new_bound_method(VM *vm, value receiver, object_closure *method);
 object_bound_native *new_bound_native(VM *vm, value receiver, bound_native_function function);
 object_namespace *new_namespace(VM *vm, object_string *name, hashmap *source);
 object_exception *new_exception(VM *vm, object_string *message, error_type type, size_t line);
+object_struct *new_struct(VM *vm, object_string *name, object_string **field_names, uint32_t field_count);
+object_record *new_record(VM *vm, object_struct *type, value *fields);
+long struct_field_slot(object_struct *type, object_string *name);
+object_builder *new_builder(VM *vm);
+void builder_append(VM *vm, object_builder *builder, object_string *string);
+object_string *builder_to_string(VM *vm, object_builder *builder);
 object_string *take_string(VM *vm, char *chars, size_t length);
 object_string *copy_string(VM *vm, const char *chars, size_t length);
 object_array *allocate_array(VM *vm, value *values, size_t length);
+object_array *allocate_scratch_array(VM *vm, value *values, size_t length);
 void array_set(VM *vm, object_array *arr, size_t index, value val);
 value array_get(VM *vm, object_array *arr, size_t index);
 uint8_t array_equality(object_array *a, object_array *b);
+object_string *concatenate_strings(VM *vm, object_string *a, object_string *b);
+void flatten_string(VM *vm, object_string *string);
+void write_string_chars(object_string *string, char *dest);
+object_string *slice_string(VM *vm, object_string *string, size_t start, size_t length);
+uint32_t string_hash(object_string *string);
+uint8_t string_equality(object_string *a, object_string *b);
 int8_t string_comparison(object_string *a, object_string *b);
 void print_object(value v);
+void print_string(object_string *string, FILE *stream);
 
 static inline uint8_t is_obj_type(value v, object_type type) {
     return IS_OBJ(v) && AS_OBJ(v)->type == type;
@@ -128,7 +128,14 @@ static token_type identifier_type(scanner *s) {
         case 'c': 
             if (s->current - s->start > 1) {
                 switch (s->start[1]) {
-                    case 'a': return check_keyword(s, 2, 3, "tch", TOKEN_CATCH);
+                    case 'a':
+                        if (s->current - s->start > 2) {
+                            switch (s->start[2]) {
+                                case 't': return check_keyword(s, 3, 2, "ch", TOKEN_CATCH);
+                                case 's': return check_keyword(s, 3, 1, "e", TOKEN_CASE);
+                            }
+                        }
+                        break;
                     case 'l': return check_keyword(s, 2, 3, "ass", TOKEN_CLASS);
                     case 'o': {
                         if (s->current - s->start > 2) {
@@ -147,7 +154,14 @@ static token_type identifier_type(scanner *s) {
                 }
             }
             break;
-        case 'd': return check_keyword(s, 1, 1, "o", TOKEN_DO);
+        case 'd':
+            if (s->current - s->start > 1) {
+                switch (s->start[1]) {
+                    case 'o': return check_keyword(s, 2, 0, "", TOKEN_DO);
+                    case 'e': return check_keyword(s, 2, 5, "fault", TOKEN_DEFAULT);
+                }
+            }
+            break;
         case 'e': return check_keyword(s, 1, 3, "lse", TOKEN_ELSE);
         case 'f':
             if (s->current - s->start > 1) {
@@ -211,7 +225,10 @@ static token_type identifier_type(scanner *s) {
             if (s->current - s->start > 1) {
                 switch (s->start[1]) {
                     case 'u': return check_keyword(s, 2, 3, "per", TOKEN_SUPER);
-                    case 't': return check_keyword(s, 2, 1, "r", TOKEN_STR);
+                    case 'w': return check_keyword(s, 2, 4, "itch", TOKEN_SWITCH);
+                    case 't':
+                        if (s->current - s->start > 3) return check_keyword(s, 2, 4, "ruct", TOKEN_STRUCT);
+                        return check_keyword(s, 2, 1, "r", TOKEN_STR);
                 }
             }
             break;
@@ -13,7 +13,7 @@ typedef enum {
     // Keywords
     TOKEN_AND, TOKEN_CLASS, TOKEN_ELSE, TOKEN_FALSE, TOKEN_FOR, TOKEN_FUNCTION, TOKEN_IF, TOKEN_THEN, TOKEN_NULL, TOKEN_OR, TOKEN_PRINT, TOKEN_RETURN,
     TOKEN_SUPER, TOKEN_THIS, TOKEN_TRUE, TOKEN_LET, TOKEN_CONST, TOKEN_WHILE, TOKEN_DO, TOKEN_BREAK, TOKEN_CONTINUE, TOKEN_UNDEFINED, TOKEN_INHERITS, TOKEN_IMPORT, TOKEN_AS,
-    TOKEN_STR, TOKEN_NUM, TOKEN_BOOL, TOKEN_ARRAY, TOKEN_NAMESPACE, TOKEN_TYPEOF, TOKEN_LEN, TOKEN_TRY, TOKEN_CATCH, TOKEN_RAISE,
+    TOKEN_STR, TOKEN_NUM, TOKEN_BOOL, TOKEN_ARRAY, TOKEN_NAMESPACE, TOKEN_TYPEOF, TOKEN_LEN, TOKEN_TRY, TOKEN_CATCH, TOKEN_RAISE, TOKEN_STRUCT, TOKEN_SWITCH, TOKEN_CASE, TOKEN_DEFAULT,
     // Control
     TOKEN_ERROR, TOKEN_EOF,
 } token_type;
@@ -10,6 +10,9 @@ void init_segment(segment *s) {
     s->bytecode = NULL;
     s->lines = NULL;
     init_value_array(&s->constants);
+    s->switches = NULL;
+    s->switch_count = 0;
+    s->switch_capacity = 0;
 }
 
 void write_to_segment(segment *s, uint8_t byte, uint32_t line) {
@@ -34,6 +37,11 @@ void destroy_segment(segment *s) {
     FREE_ARRAY(NULL, uint8_t, s->bytecode, s->capacity);
     FREE_ARRAY(NULL, uint32_t, s->lines, s->capacity);
     destroy_value_array(NULL, &s->constants);
+    for (uint32_t i = 0; i < s->switch_count; i++) {
+        FREE_ARRAY(NULL, switch_case, s->switches[i].cases, s->switches[i].case_capacity);
+        FREE_ARRAY(NULL, size_t, s->switches[i].dense_targets, s->switches[i].dense_len);
+    }
+    FREE_ARRAY(NULL, switch_table, s->switches, s->switch_capacity);
     init_segment(s);
 }
 
@@ -46,4 +54,21 @@ size_t add_constant(segment *s, value val) {
     }
     write_to_value_array(NULL, &s->constants, val);
     return id;
+}
+
+uint32_t add_switch_table(segment *s) {
+    if (s->switch_count >= s->switch_capacity) {
+        uint32_t oldc = s->switch_capacity;
+        s->switch_capacity = GROW_CAPACITY(oldc);
+        s->switches = GROW_ARRAY(NULL, switch_table, s->switches, oldc, s->switch_capacity);
+    }
+    switch_table *t = &s->switches[s->switch_count];
+    t->kind = SWITCH_GENERIC;
+    t->default_target = 0;
+    t->cases = NULL;
+    t->case_capacity = 0;
+    t->dense_min = 0;
+    t->dense_targets = NULL;
+    t->dense_len = 0;
+    return s->switch_count++;
 }
\ No newline at end of file
@@ -11,6 +11,9 @@
 
 #define JUMP_OFFSET_LEN 5
 
+#define RETURNS_ANY 0 // Values-wanted operand of a call whose result is discarded - any number of values will do, only the first is kept
+#define RETURNS_FORWARD UINT8_MAX // Values-wanted operand of a call returned straight out of a function - wants what that function's caller wants
+
 typedef enum {
     // No operand
     OP_RETURN,
@@ -35,6 +38,7 @@ typedef enum {
     OP_PRINT,
     OP_POP,
     OP_MAKE_ARRAY,
+    OP_MAKE_ARRAY_SCRATCH, // Array that never escapes its scope - allocated frame-locally rather than on the GC heap
     OP_ARRAY_GET,
     OP_ARRAY_GET_KEEP_REF,
     OP_ARRAY_SET,
@@ -46,12 +50,17 @@ typedef enum {
     OP_UNREGISTER_CATCH,
     OP_MARK_ERRORS_HANDLED,
     OP_RAISE,
+    OP_SEAL_CLASS,
+    OP_STR_OVERRIDE, // Calls __str__ on an instance that has one, leaving anything else for OP_PRINT to write as it is
     // One-byte operand
     OP_POPN,
-    OP_CALL,
     OP_PUSH_TYPEOF,
     OP_CONV_TYPE,
+    OP_RETURN_MULTI, // Number of values returned, or 0 to return the values of a forwarded call
+    // Two-byte operand
+    OP_CALL, // Number of arguments, then number of values wanted (a count, RETURNS_ANY or RETURNS_FORWARD)
     // Three-byte operand 
+    OP_SWITCH, // Index into the segment's switch tables
     // Five-byte operand
     OP_JUMP_IF_FALSE,
     OP_JUMP_IF_TRUE,
@@ -59,6 +68,7 @@ typedef enum {
     OP_LOOP,
     // Variable-length operand
     OP_CLOSURE,
+    OP_CLOSURE_SCRATCH, // Same operands as OP_CLOSURE
     // Variable-length via OP_LONG (one byte without, three bytes with)
     OP_CONSTANT,
     OP_DEFINE_GLOBAL,
@@ -72,22 +82,51 @@ typedef enum {
     OP_GET_PROPERTY,
     OP_GET_PROPERTY_KEEP_REF,
     OP_SET_PROPERTY,
+    OP_GET_FIELD, // 1-byte struct field slot guessed by the compiler, then the same operand as OP_GET_PROPERTY
+    OP_SET_FIELD, // 1-byte struct field slot guessed by the compiler, then the same operand as OP_SET_PROPERTY
     OP_METHOD,
-    OP_INVOKE, // Variable length with an extra byte for the number of arguments
-    OP_GET_SUPER,
-    OP_INVOKE_SUPER, // Variable length with an extra byte for the number of arguments
+    OP_INVOKE, // Variable length with an extra byte for the number of arguments, then the same inline cache as OP_GET_SUPER, then values wanted as for OP_CALL
+    OP_GET_SUPER, // Followed by a 7-byte inline cache (4-byte class id, 3-byte vtable slot)
+    OP_INVOKE_SUPER, // Same operands as OP_INVOKE
     OP_IMPORT,
+    OP_RELEASE_SCRATCH, // Frees the frame-local object held in the given local slot
     OP_BUILD_NAMESPACE, // 1-byte count N, then N * (3-byte slot + 3-byte name constant)
     // One-byte operand followed by 6 byte jump address
     OP_REGISTER_CATCH,
 } opcode;
 
+typedef enum {
+    SWITCH_DENSE, // Integer cases close enough together to index directly
+    SWITCH_SPARSE, // Other numeric cases, sorted for binary search
+    SWITCH_STRING, // String cases, hashed on the interned string pointer
+    SWITCH_ERROR, // Error type cases, indexed by error type
+    SWITCH_GENERIC, // Mixed case types, checked in order
+} switch_kind;
+
+typedef struct {
+    value key;
+    size_t target;
+} switch_case;
+
+typedef struct {
+    switch_kind kind;
+    size_t default_target;
+    switch_case *cases; // Sparse, string (open addressed, NULL_VAL keys are empty) and generic tables
+    uint32_t case_capacity;
+    long dense_min;
+    size_t *dense_targets; // Dense and error tables, holes hold the default target
+    uint32_t dense_len;
+} switch_table;
+
 typedef struct {
     size_t len;
     size_t capacity;
     uint8_t *bytecode;
     uint32_t *lines;
     value_array constants;
+    switch_table *switches;
+    uint32_t switch_count;
+    uint32_t switch_capacity;
 } segment;
 
 void init_segment(segment *s);
@@ -95,5 +134,6 @@ void write_to_segment(segment *s, uint8_t byte, uint32_t line);
 void write_n_bytes_to_segment(segment *s, uint8_t *bytes, size_t num_bytes, uint32_t line);
 void destroy_segment(segment *s);
 size_t add_constant(segment *s, value val);
+uint32_t add_switch_table(segment *s);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,108 @@
+#define _DEFAULT_SOURCE // For MAP_ANONYMOUS, MAP_NORESERVE, madvise and sigaction
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "stack.h"
+
+// A VM's stack is mapped, run on and unmapped by one thread, and a fault is delivered to the thread that caused it,
+// so each thread keeps its own list and the handler never sees another thread changing it
+static _Thread_local stack_region *regions = NULL;
+static pthread_mutex_t handler_lock = PTHREAD_MUTEX_INITIALIZER; // Guards mapped_count and installing the handler
+static size_t mapped_count = 0; // Stacks mapped across every thread - the fault handler is installed while there are any
+static struct sigaction previous_segv; // Only written before the handler is installed, so the handler can read it freely
+
+static size_t page_size(void) {
+    static size_t size = 0;
+    if (size == 0) size = (size_t) sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+static void stack_fault(int sig, siginfo_t *info, void *context) {
+    char *address = info->si_addr;
+    stack_region *s = regions;
+    while (s != NULL && (address < s->base || address >= s->base + s->reserved + page_size())) s = s->next;
+    if (s != NULL) {
+        char *guard = s->base + s->reserved;
+        if (address >= s->base + s->committed && address < guard) { // Grown past what's committed, so commit up to the fault and carry on
+            size_t committed = ((size_t) (address - s->base) / STACK_COMMIT_CHUNK + 1) * STACK_COMMIT_CHUNK;
+            if (mprotect(s->base + s->committed, committed - s->committed, PROT_READ | PROT_WRITE) == 0) {
+                s->committed = committed;
+                return;
+            }
+        }
+        else if (address >= guard && address < guard + page_size() && s->guarded) {
+            longjmp(s->overflow, 1); // SA_NODEFER means SIGSEGV isn't left blocked by jumping out
+        }
+    }
+    // Not ours - pass it on to whoever handled it before, leaving ourselves installed for the stacks still mapped
+    if (previous_segv.sa_flags & SA_SIGINFO) previous_segv.sa_sigaction(sig, info, context);
+    else if (previous_segv.sa_handler == SIG_DFL) { // Nothing to chain to, so die of it as if we'd never been here
+        signal(sig, SIG_DFL);
+        raise(sig);
+    }
+    else if (previous_segv.sa_handler != SIG_IGN) previous_segv.sa_handler(sig);
+}
+
+void map_stack(stack_region *s, size_t bytes) {
+    s->reserved = (bytes + STACK_COMMIT_CHUNK - 1) / STACK_COMMIT_CHUNK * STACK_COMMIT_CHUNK;
+    void *base = mmap(NULL, s->reserved + page_size(), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED || mprotect(base, STACK_COMMIT_CHUNK, PROT_READ | PROT_WRITE) != 0) {
+        fprintf(stderr, "Failed to allocate memory, exiting...\n");
+        exit(1);
+    }
+    s->base = base;
+    s->committed = STACK_COMMIT_CHUNK;
+    s->guarded = 0;
+    s->next = regions;
+    regions = s;
+    pthread_mutex_lock(&handler_lock);
+    if (mapped_count++ == 0) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = stack_fault;
+        action.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &previous_segv);
+    }
+    pthread_mutex_unlock(&handler_lock);
+}
+
+void unmap_stack(stack_region *s) {
+    stack_region **link = &regions;
+    while (*link != NULL && *link != s) link = &(*link)->next;
+    if (*link != NULL) *link = s->next;
+    pthread_mutex_lock(&handler_lock);
+    if (--mapped_count == 0) {
+        struct sigaction current;
+        sigaction(SIGSEGV, NULL, &current);
+        // An embedder may have installed its own handler over ours since, in which case it stays and ours is just left unused
+        if ((current.sa_flags & SA_SIGINFO) && current.sa_sigaction == stack_fault) sigaction(SIGSEGV, &previous_segv, NULL);
+    }
+    pthread_mutex_unlock(&handler_lock);
+    munmap(s->base, s->reserved + page_size());
+    s->base = NULL;
+}
+
+void decommit_stack(stack_region *s, size_t used) { // Gives back the pages above the first used bytes if the stack is particularly oversized
+    if (s->committed < STACK_COMMIT_CHUNK * 2 || used * 4 >= s->committed) return;
+    size_t keep = (used * 2 + STACK_COMMIT_CHUNK - 1) / STACK_COMMIT_CHUNK * STACK_COMMIT_CHUNK;
+    if (keep < STACK_COMMIT_CHUNK) keep = STACK_COMMIT_CHUNK;
+    madvise(s->base + keep, s->committed - keep, MADV_DONTNEED);
+    mprotect(s->base + keep, s->committed - keep, PROT_NONE);
+    #ifdef DEBUG_LOG_GC
+        printf("released %zu bytes of VM stack (from %zu to %zu)\n", s->committed - keep, s->committed, keep);
+    #endif
+    s->committed = keep;
+}
+
+void lend_guard_page(stack_region *s) { // Room to raise the overflow error on top of the full stack
+    mprotect(s->base + s->reserved, page_size(), PROT_READ | PROT_WRITE);
+}
+
+void restore_guard_page(stack_region *s) {
+    mprotect(s->base + s->reserved, page_size(), PROT_NONE);
+}
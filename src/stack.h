@@ -0,0 +1,25 @@
+#ifndef canidae_stack_h
+
+#define canidae_stack_h
+
+#include <setjmp.h>
+#include "common.h"
+
+#define STACK_COMMIT_CHUNK (64 * 1024) // Bytes of the reservation made usable at a time as the stack grows into it
+
+typedef struct stack_region {
+    struct stack_region *next; // The mapping thread's stacks are on one list, which the fault handler searches
+    char *base;
+    size_t reserved; // Bytes before the guard page, a whole number of commit chunks
+    size_t committed; // Bytes at the bottom of the reservation that are readable and writable
+    uint8_t guarded; // Running into the guard page jumps to overflow, rather than crashing
+    jmp_buf overflow;
+} stack_region;
+
+void map_stack(stack_region *s, size_t bytes);
+void unmap_stack(stack_region *s);
+void decommit_stack(stack_region *s, size_t used);
+void lend_guard_page(stack_region *s);
+void restore_guard_page(stack_region *s);
+
+#endif
@@ -1,4 +1,5 @@
 #include "stdlib_arrays.h"
+#include "memory.h"
 #include "value.h"
 #include "vm.h"
 
@@ -8,6 +9,7 @@ value array_push_native(VM *vm, value receiver, uint8_t argc, value *argv) {
         return HANDLED_NATIVE_ERROR_VAL;
     }
     write_to_value_array(vm, &AS_ARRAY(receiver)->arr, argv[0]);
+    write_barrier(vm, AS_OBJ(receiver), argv[0]);
     return NULL_VAL;
 }
 
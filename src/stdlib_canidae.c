@@ -8,6 +8,7 @@
 #include <string.h>
 #include <math.h>
 #include "stdlib_canidae.h"
+#include "type_conversions.h"
 
 static value read_line(VM *vm, FILE *f) { // Helper function to read a line as an obj_string, not intended to be a directly accessible part of the lib
     size_t capacity = 0;
@@ -59,6 +60,7 @@ static value read_file_native(VM *vm, uint8_t argc, value *args) {
         if (!runtime_error(vm, TYPE_ERROR, "Function 'read_file' expects a string filename.")) return NATIVE_ERROR_VAL;
         return HANDLED_NATIVE_ERROR_VAL;
     }
+    flatten_string(vm, AS_STRING(args[0]));
     const char *path = AS_CSTRING(args[0]);
     FILE *f = fopen(path, "rb");
     if (f == NULL) {
@@ -99,6 +101,7 @@ static value exception_native(VM *vm, uint8_t argc, value *args) {
         if(!runtime_error(vm, TYPE_ERROR, "Function 'exception' expects its second argument is a string.")) return NATIVE_ERROR_VAL;
         return HANDLED_NATIVE_ERROR_VAL;
     }
+    flatten_string(vm, AS_STRING(args[1])); // Messages are printed straight from their characters
     call_frame *frame = vm->active_frame;
     object_function *function = frame->closure->function;
     size_t instruction = frame->ip - function->seg.bytecode - 1;
@@ -107,15 +110,146 @@ static value exception_native(VM *vm, uint8_t argc, value *args) {
     return OBJ_VAL(exception);
 }
 
+static value view_string(VM *vm, const char *name, value *args, double start, double end) { // Shared by slice and substr once they know the range
+    object_string *string = AS_STRING(args[0]);
+    if (!(start >= 0 && end >= start && end <= string->length)) { // Written so that NaN fails it too
+        if (!runtime_error(vm, INDEX_ERROR, "Function '%s' got a range outside the string (length %zu).", name, string->length)) return NATIVE_ERROR_VAL;
+        return HANDLED_NATIVE_ERROR_VAL;
+    }
+    return OBJ_VAL(slice_string(vm, string, (size_t) start, (size_t) end - (size_t) start)); // Long pieces are views of the original, not copies
+}
+
+static value slice_native(VM *vm, uint8_t argc, value *args) {
+    if (argc != 3) {
+        if (!runtime_error(vm, ARGUMENT_ERROR, "Function 'slice' expects 3 arguments (got %u).", argc)) return NATIVE_ERROR_VAL;
+        return HANDLED_NATIVE_ERROR_VAL;
+    }
+    if (!IS_STRING(args[0]) || !IS_NUMBER(args[1]) || !IS_NUMBER(args[2])) {
+        if (!runtime_error(vm, TYPE_ERROR, "Function 'slice' expects a string, a start index and an end index.")) return NATIVE_ERROR_VAL;
+        return HANDLED_NATIVE_ERROR_VAL;
+    }
+    double start = AS_NUMBER(args[1]);
+    double end = AS_NUMBER(args[2]);
+    if (start < 0) start += AS_STRING(args[0])->length; // Negative indices count back from the end, as with indexing
+    if (end < 0) end += AS_STRING(args[0])->length;
+    return view_string(vm, "slice", args, start, end);
+}
+
+static value substr_native(VM *vm, uint8_t argc, value *args) {
+    if (argc != 3) {
+        if (!runtime_error(vm, ARGUMENT_ERROR, "Function 'substr' expects 3 arguments (got %u).", argc)) return NATIVE_ERROR_VAL;
+        return HANDLED_NATIVE_ERROR_VAL;
+    }
+    if (!IS_STRING(args[0]) || !IS_NUMBER(args[1]) || !IS_NUMBER(args[2])) {
+        if (!runtime_error(vm, TYPE_ERROR, "Function 'substr' expects a string, a start index and a length.")) return NATIVE_ERROR_VAL;
+        return HANDLED_NATIVE_ERROR_VAL;
+    }
+    double start = AS_NUMBER(args[1]);
+    if (start < 0) start += AS_STRING(args[0])->length;
+    return view_string(vm, "substr", args, start, start + AS_NUMBER(args[2]));
+}
+
+static value string_builder_native(VM *vm, uint8_t argc, value *args) {
+    if (argc != 0) {
+        if (!runtime_error(vm, ARGUMENT_ERROR, "Function 'StringBuilder' expects 0 arguments (got %u).", argc)) return NATIVE_ERROR_VAL;
+        return HANDLED_NATIVE_ERROR_VAL;
+    }
+    return OBJ_VAL(new_builder(vm));
+}
+
+static value join_native(VM *vm, uint8_t argc, value *args) {
+    if (argc != 2) {
+        if (!runtime_error(vm, ARGUMENT_ERROR, "Function 'join' expects 2 arguments (got %u).", argc)) return NATIVE_ERROR_VAL;
+        return HANDLED_NATIVE_ERROR_VAL;
+    }
+    if (!IS_ARRAY(args[0]) || !IS_STRING(args[1])) {
+        if (!runtime_error(vm, TYPE_ERROR, "Function 'join' expects an array and a string separator.")) return NATIVE_ERROR_VAL;
+        return HANDLED_NATIVE_ERROR_VAL;
+    }
+    size_t count = AS_ARRAY(args[0])->arr.len;
+    value pieces = args[0]; // Swapped for a copy holding the converted items if any aren't strings yet
+    push_root(vm, &pieces);
+    for (size_t i = 0; i < count; i++) {
+        value item = AS_ARRAY(pieces)->arr.values[i];
+        if (IS_STRING(item)) continue;
+        if (AS_OBJ(pieces) == AS_OBJ(args[0])) {
+            value *values = ALLOCATE(vm, value, count);
+            memcpy(values, AS_ARRAY(args[0])->arr.values, count * sizeof(value));
+            pieces = OBJ_VAL(allocate_array(vm, values, count));
+        }
+        item = to_str(vm, item);
+        if (IS_NATIVE_ERROR(item) || IS_HANDLED_NATIVE_ERROR(item)) {
+            pop_roots(vm, 1);
+            return item;
+        }
+        AS_ARRAY(pieces)->arr.values[i] = item;
+        write_barrier(vm, AS_OBJ(pieces), item);
+    }
+    object_string *separator = AS_STRING(args[1]);
+    value *values = AS_ARRAY(pieces)->arr.values; // Nothing moves objects outside a safe point, so this stays valid
+    size_t length = count > 0 ? separator->length * (count - 1) : 0;
+    for (size_t i = 0; i < count; i++) length += AS_STRING(values[i])->length;
+    char *chars = ALLOCATE(vm, char, length + 1); // Sized exactly, so nothing is copied twice
+    char *dest = chars;
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            write_string_chars(separator, dest);
+            dest += separator->length;
+        }
+        write_string_chars(AS_STRING(values[i]), dest);
+        dest += AS_STRING(values[i])->length;
+    }
+    *dest = '\0';
+    pop_roots(vm, 1);
+    return OBJ_VAL(take_string(vm, chars, length));
+}
+
+static void set_stat(VM *vm, object_namespace *stats, const char *name, double n) {
+    value key = OBJ_VAL(copy_string(vm, name, strlen(name)));
+    push_root(vm, &key); // Growing the namespace can collect
+    hashmap_set(&stats->values, vm, AS_STRING(key), NUMBER_VAL(n));
+    write_barrier(vm, (object*) stats, key);
+    pop_roots(vm, 1);
+}
+
+static value gc_stats_native(VM *vm, uint8_t argc, value *args) {
+    if (argc != 0) {
+        if (!runtime_error(vm, ARGUMENT_ERROR, "Function 'gc_stats' expects 0 arguments (got %u).", argc)) return NATIVE_ERROR_VAL;
+        return HANDLED_NATIVE_ERROR_VAL;
+    }
+    value name = OBJ_VAL(copy_string(vm, "gc_stats", 8));
+    push_root(vm, &name);
+    value result = OBJ_VAL(new_namespace(vm, AS_STRING(name), NULL));
+    push_root(vm, &result);
+    object_namespace *stats = AS_NAMESPACE(result); // Nothing moves objects outside a safe point, so this stays valid
+    set_stat(vm, stats, "minor", (double) vm->gc_stats.minor_collections);
+    set_stat(vm, stats, "major", (double) vm->gc_stats.major_collections);
+    set_stat(vm, stats, "steps", (double) vm->gc_stats.mark_steps);
+    set_stat(vm, stats, "max_pause_ms", vm->gc_stats.max_pause_ns / 1e6);
+    set_stat(vm, stats, "total_pause_ms", vm->gc_stats.total_pause_ns / 1e6);
+    set_stat(vm, stats, "freed", (double) vm->gc_stats.bytes_freed);
+    set_stat(vm, stats, "compacted", (double) vm->gc_stats.pages_compacted);
+    set_stat(vm, stats, "next_major", (double) vm->major_threshold);
+    set_stat(vm, stats, "arena", (double) vm->heap.arena_bytes);
+    set_stat(vm, stats, "heap", (double) vm->bytes_allocated);
+    pop_roots(vm, 2);
+    return result;
+}
+
 void define_stdlib(VM *vm) {
     disable_gc(vm);
-    define_native(vm, "clock", clock_native);
-    define_native(vm, "input", input);
+    define_gc_safe_native(vm, "clock", clock_native);
+    define_gc_safe_native(vm, "input", input);
     char *error_strings[8] = {"NameError", "TypeError", "ValueError", "ImportError", "ArgumentError", "RecursionError", "MemoryError", "IndexError"};
     for (int i = 0; i < 8; i++) {
         define_native_global(vm, error_strings[i], ERROR_TYPE_VAL(i));
     }
-    define_native(vm, "exception", exception_native);
-    define_native(vm, "read_file", read_file_native);
+    define_gc_safe_native(vm, "exception", exception_native);
+    define_gc_safe_native(vm, "read_file", read_file_native);
+    define_gc_safe_native(vm, "gc_stats", gc_stats_native);
+    define_gc_safe_native(vm, "slice", slice_native);
+    define_gc_safe_native(vm, "substr", substr_native);
+    define_gc_safe_native(vm, "StringBuilder", string_builder_native);
+    define_gc_safe_native(vm, "join", join_native);
     enable_gc(vm);
 }
\ No newline at end of file
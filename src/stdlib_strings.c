@@ -0,0 +1,36 @@
+#include "stdlib_strings.h"
+#include "memory.h"
+#include "value.h"
+#include "vm.h"
+#include "type_conversions.h"
+
+value builder_append_native(VM *vm, value receiver, uint8_t argc, value *argv) {
+    if (argc != 1) {
+        if (!runtime_error(vm, ARGUMENT_ERROR, "append() takes 1 argument (got %u).", argc)) return NATIVE_ERROR_VAL;
+        return HANDLED_NATIVE_ERROR_VAL;
+    }
+    object_builder *builder = AS_BUILDER(receiver);
+    if (IS_STRING(argv[0])) {
+        builder_append(vm, builder, AS_STRING(argv[0]));
+        return receiver; // So appends can be chained
+    }
+    // Anything else is formatted straight into the builder's buffer, rather than into a string first
+    value_writer writer = {NULL, builder->chars, builder->length, builder->capacity};
+    uint8_t written = write_value(vm, &writer, argv[0]);
+    builder->chars = writer.chars;
+    builder->capacity = writer.capacity;
+    if (!written) {
+        if (!runtime_error(vm, TYPE_ERROR, "Unprintable object type (how did you even access this?)")) return NATIVE_ERROR_VAL;
+        return HANDLED_NATIVE_ERROR_VAL;
+    }
+    builder->length = writer.length;
+    return receiver;
+}
+
+value builder_build_native(VM *vm, value receiver, uint8_t argc, value *argv) {
+    if (argc != 0) {
+        if (!runtime_error(vm, ARGUMENT_ERROR, "build() takes 0 arguments (got %u).", argc)) return NATIVE_ERROR_VAL;
+        return HANDLED_NATIVE_ERROR_VAL;
+    }
+    return OBJ_VAL(builder_to_string(vm, AS_BUILDER(receiver)));
+}
@@ -0,0 +1,9 @@
+#ifndef canidae_stdlib_strings_h
+#define canidae_stdlib_strings_h
+
+#include "object.h"
+
+value builder_append_native(VM *vm, value receiver, uint8_t argc, value *argv);
+value builder_build_native(VM *vm, value receiver, uint8_t argc, value *argv);
+
+#endif
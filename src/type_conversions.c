@@ -7,126 +7,189 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <stdarg.h>
 #include "stdlib_canidae.h"
+#include "type_conversions.h"
 
-value to_str(VM *vm, value arg) {
+static void reserve(VM *vm, value_writer *writer, size_t length) { // Always leaves room for a terminator
+    if (writer->length + length < writer->capacity) return;
+    size_t old_capacity = writer->capacity;
+    while (writer->capacity <= writer->length + length) writer->capacity = GROW_CAPACITY(writer->capacity);
+    writer->chars = GROW_ARRAY(vm, char, writer->chars, old_capacity, writer->capacity);
+}
+
+static void write_chars(VM *vm, value_writer *writer, const char *chars, size_t length) {
+    if (writer->stream != NULL) {
+        fwrite(chars, 1, length, writer->stream);
+        return;
+    }
+    reserve(vm, writer, length);
+    memcpy(writer->chars + writer->length, chars, length);
+    writer->length += length;
+}
+
+static void write_format(VM *vm, value_writer *writer, const char *format, ...) {
+    va_list args;
+    va_list args_2;
+    va_start(args, format);
+    va_copy(args_2, args);
+    if (writer->stream != NULL) {
+        vfprintf(writer->stream, format, args);
+    } else {
+        int length = vsnprintf(NULL, 0, format, args);
+        reserve(vm, writer, length);
+        vsnprintf(writer->chars + writer->length, length + 1, format, args_2);
+        writer->length += length;
+    }
+    va_end(args);
+    va_end(args_2);
+}
+
+static void write_string(VM *vm, value_writer *writer, object_string *string) {
+    if (writer->stream != NULL) {
+        print_string(string, writer->stream);
+        return;
+    }
+    reserve(vm, writer, string->length);
+    write_string_chars(string, writer->chars + writer->length);
+    writer->length += string->length;
+}
+
+uint8_t write_value(VM *vm, value_writer *writer, value arg) { // Allocates nothing but the writer's buffer, so whatever's being written only has to be reachable
     switch (arg.type) {
         case NUM_TYPE: {
-            double number = AS_NUMBER(arg);
-            int len = snprintf(NULL, 0, "%g", number);
-            char *result = ALLOCATE(vm, char, len + 1);
-            snprintf(result, len + 1, "%g", number);
-            return OBJ_VAL(take_string(vm, result, len));
+            write_format(vm, writer, "%g", AS_NUMBER(arg));
+            return 1;
         }
         case NULL_TYPE: {
-            return OBJ_VAL(copy_string(vm, "null", 4));
+            write_chars(vm, writer, "null", 4);
+            return 1;
         }
         case UNDEFINED_TYPE: {
-            return OBJ_VAL(copy_string(vm, "undefined", 9));
+            write_chars(vm, writer, "undefined", 9);
+            return 1;
         }
         case BOOL_TYPE: {
-            return OBJ_VAL(copy_string(vm, arg.as.boolean ? "true" : "false", arg.as.boolean ? 4 : 5));
+            write_chars(vm, writer, arg.as.boolean ? "true" : "false", arg.as.boolean ? 4 : 5);
+            return 1;
         }
         case TYPE_TYPE: {
             char type_strings[7][10] = {"num", "bool", "str", "array", "class", "function", "namespace"};
-            long len = snprintf(NULL, 0, "<type %s>", type_strings[arg.as.type]);
-            char *result = ALLOCATE(vm, char, len + 1);
-            snprintf(result, len + 1, "<type %s>", type_strings[arg.as.type]);
-            return OBJ_VAL(take_string(vm, result, len));
+            write_format(vm, writer, "<type %s>", type_strings[arg.as.type]);
+            return 1;
         }
         case ERROR_TYPE: {
             char *error_strings[8] = {"NameError", "TypeError", "ValueError", "ImportError", "ArgumentError", "RecursionError", "MemoryError", "IndexError"};
-            long len =  snprintf(NULL, 0, "<errortype %s>", error_strings[AS_ERROR_TYPE(arg)]);
-            char *result = ALLOCATE(vm, char, len + 1);
-            snprintf(result, len + 1, "<errortype %s>", error_strings[AS_ERROR_TYPE(arg)]);
-            return OBJ_VAL(take_string(vm, result, len));
+            write_format(vm, writer, "<errortype %s>", error_strings[AS_ERROR_TYPE(arg)]);
+            return 1;
         }
         case OBJ_TYPE: {
-            #define FN_TO_STRING(function) \
-                long len = snprintf(NULL, 0, "<function %s>", function->name->chars); \
-                char *result = ALLOCATE(vm, char, len + 1); \
-                snprintf(result, len + 1, "<function %s>", function->name->chars); \
-                return OBJ_VAL(take_string(vm, result, len));
             switch (GET_OBJ_TYPE(arg)) {
                 case OBJ_STRING: {
-                    return arg;
+                    write_string(vm, writer, AS_STRING(arg));
+                    return 1;
                 }
                 case OBJ_NATIVE: {
-                    return OBJ_VAL(copy_string(vm, "<native function>", 17));
+                    write_chars(vm, writer, "<native function>", 17);
+                    return 1;
                 }
                 case OBJ_FUNCTION: {
-                    FN_TO_STRING(AS_FUNCTION(arg));
+                    write_format(vm, writer, "<function %s>", AS_FUNCTION(arg)->name->chars);
+                    return 1;
                 }
                 case OBJ_CLOSURE: {
-                    FN_TO_STRING(AS_CLOSURE(arg)->function);
+                    write_format(vm, writer, "<function %s>", AS_CLOSURE(arg)->function->name->chars);
+                    return 1;
                 }
-                case OBJ_ARRAY: {
-                    #define APPEND_VAL(i) \
-                        object_string *item_as_str = AS_STRING(to_str(vm, (array->arr.values[i]))); \
-                        size_t newlen = len + item_as_str->length + 2; \
-                        if (newlen > capacity) { \
-                            size_t oldc = capacity; \
-                            capacity = GROW_CAPACITY(oldc); \
-                            result = GROW_ARRAY(vm, char, result, oldc, capacity); \
-                        } \
-                        strcat(result, item_as_str->chars);
+                case OBJ_BOUND_METHOD: {
+                    write_format(vm, writer, "<function %s>", AS_BOUND_METHOD(arg)->method->function->name->chars);
+                    return 1;
+                }
+                case OBJ_ARRAY: { // Items are written straight in, so nested arrays never build strings of their own
                     object_array *array = AS_ARRAY(arg);
-                    size_t capacity = 2;
-                    size_t len = 2;
-                    char *result = ALLOCATE(vm, char, capacity);
-                    strcpy(result, "[");
-                    for (size_t i = 0; i < array->arr.len-1; i++) {
-                        APPEND_VAL(i);
-                        strcat(result, ", ");
-                        len = newlen;
+                    write_chars(vm, writer, "[", 1);
+                    for (size_t i = 0; i < array->arr.len; i++) {
+                        if (i > 0) write_chars(vm, writer, ", ", 2);
+                        if (!write_value(vm, writer, array->arr.values[i])) return 0;
                     }
-                    APPEND_VAL(array->arr.len-1);
-                    if (capacity < len + 2) result = realloc(result, len + 2);
-                    strcat(result, "]\0");
-                    return OBJ_VAL(take_string(vm, result, len));
-                    #undef APPEND_VAL
+                    write_chars(vm, writer, "]", 1);
+                    return 1;
                 }
                 case OBJ_CLASS: {
-                    object_class *class_ = AS_CLASS(arg);
-                    long len = snprintf(NULL, 0, "<class %s>", class_->name->chars);
-                    char *result = ALLOCATE(vm, char, len + 1);
-                    snprintf(result, len + 1, "<class %s>", class_->name->chars);
-                    return OBJ_VAL(take_string(vm, result, len));
+                    write_format(vm, writer, "<class %s>", AS_CLASS(arg)->name->chars);
+                    return 1;
                 }
                 case OBJ_INSTANCE: {
-                    object_instance *instance = AS_INSTANCE(arg);
-                    long len = snprintf(NULL, 0, "<%s instance at %p>", instance->class_->name->chars, (void*) AS_OBJ(arg));
-                    char *result = ALLOCATE(vm, char, len + 1);
-                    snprintf(result, len + 1, "<%s instance at %p>", instance->class_->name->chars, (void*) AS_OBJ(arg));
-                    return OBJ_VAL(take_string(vm, result, len));
-                }
-                case OBJ_BOUND_METHOD: {
-                    FN_TO_STRING(AS_BOUND_METHOD(arg)->method->function);
+                    write_format(vm, writer, "<%s instance at %p>", AS_INSTANCE(arg)->class_->name->chars, (void*) AS_OBJ(arg));
+                    return 1;
                 }
                 case OBJ_NAMESPACE: {
                     object_namespace *namespace = AS_NAMESPACE(arg);
-                    long len = snprintf(NULL, 0, "<namespace %s>", namespace->name->chars);
-                    char *result = ALLOCATE(vm, char, len + 1);
-                    snprintf(result, len + 1, "<namespace %s>", namespace->name->chars);
-                    return OBJ_VAL(take_string(vm, result, len));
+                    if (namespace->name == NULL) write_chars(vm, writer, "<namespace>", 11);
+                    else write_format(vm, writer, "<namespace %s>", namespace->name->chars);
+                    return 1;
                 }
                 case OBJ_EXCEPTION: {
                     char *error_strings[8] = {"NameError", "TypeError", "ValueError", "ImportError", "ArgumentError", "RecursionError", "MemoryError", "IndexError"};
-                    long len =  snprintf(NULL, 0, "<exception %s '%s'>", error_strings[AS_EXCEPTION(arg)->type], (AS_EXCEPTION(arg))->message->chars);
-                    char *result = ALLOCATE(vm, char, len + 1);
-                    snprintf(result, len + 1, "<exception %s '%s'>", error_strings[AS_EXCEPTION(arg)->type], (AS_EXCEPTION(arg))->message->chars);
-                    return OBJ_VAL(take_string(vm, result, len));
+                    write_format(vm, writer, "<exception %s '%s'>", error_strings[AS_EXCEPTION(arg)->type], AS_EXCEPTION(arg)->message->chars);
+                    return 1;
+                }
+                case OBJ_STRUCT: {
+                    write_format(vm, writer, "<struct %s>", AS_STRUCT(arg)->name->chars);
+                    return 1;
+                }
+                case OBJ_RECORD: {
+                    write_format(vm, writer, "<%s record at %p>", AS_RECORD(arg)->type->name->chars, (void*) AS_OBJ(arg));
+                    return 1;
+                }
+                case OBJ_BUILDER: {
+                    write_chars(vm, writer, "<string builder>", 16);
+                    return 1;
                 }
                 default:
-                    if(!runtime_error(vm, TYPE_ERROR, "Unprintable object type (how did you even access this?)")) return NATIVE_ERROR_VAL;
-                    return HANDLED_NATIVE_ERROR_VAL;
+                    return 0;
             }
-            #undef FN_TO_STRING
+        }
+    }
+    return 0;
+}
+
+value to_str(VM *vm, value arg) {
+    switch (arg.type) {
+        case NUM_TYPE: {
+            double number = AS_NUMBER(arg);
+            uint8_t small_int = !signbit(number) && number < SMALL_INT_STRINGS && number == (long) number;
+            if (small_int && vm->int_strings[(long) number] != NULL) return OBJ_VAL(vm->int_strings[(long) number]);
+            char result[32]; // %g never needs more than this
+            int len = snprintf(result, sizeof(result), "%g", number);
+            object_string *string = copy_string(vm, result, len);
+            if (small_int) vm->int_strings[(long) number] = string;
+            return OBJ_VAL(string);
+        }
+        case NULL_TYPE: {
+            return OBJ_VAL(copy_string(vm, "null", 4));
+        }
+        case UNDEFINED_TYPE: {
+            return OBJ_VAL(copy_string(vm, "undefined", 9));
+        }
+        case BOOL_TYPE: {
+            return OBJ_VAL(copy_string(vm, arg.as.boolean ? "true" : "false", arg.as.boolean ? 4 : 5));
+        }
+        case OBJ_TYPE: {
+            if (IS_STRING(arg)) return arg;
             break;
         }
+        default: break;
+    }
+    value_writer writer = {NULL, NULL, 0, 0};
+    if (!write_value(vm, &writer, arg)) {
+        FREE_ARRAY(vm, char, writer.chars, writer.capacity);
+        if(!runtime_error(vm, TYPE_ERROR, "Unprintable object type (how did you even access this?)")) return NATIVE_ERROR_VAL;
+        return HANDLED_NATIVE_ERROR_VAL;
     }
-    if(!runtime_error(vm, TYPE_ERROR, "Failed to convert value to string.")) return NATIVE_ERROR_VAL;
-    return HANDLED_NATIVE_ERROR_VAL;
+    writer.chars[writer.length] = '\0';
+    if (writer.capacity != writer.length + 1) writer.chars = GROW_ARRAY(vm, char, writer.chars, writer.capacity, writer.length + 1); // take_string frees it as length + 1 bytes
+    return OBJ_VAL(take_string(vm, writer.chars, writer.length));
 }
 
 value to_num(VM *vm, value arg) {
@@ -138,6 +201,7 @@ value to_num(VM *vm, value arg) {
         case OBJ_TYPE:
             switch (GET_OBJ_TYPE(v)) {
                 case OBJ_STRING: {
+                    flatten_string(vm, AS_STRING(v));
                     char *string = AS_CSTRING(v);
                     double conv = atof(string);
                     if (conv != 0 || (strspn(string, "0.") == strlen(string) && strchr(string, '.') == strrchr(string, '.'))) {
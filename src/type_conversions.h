@@ -2,8 +2,17 @@
 
 #define canidae_type_conversions_h
 
+#include <stdio.h>
 #include "value.h"
 
+typedef struct {
+    FILE *stream; // Written straight through when set, otherwise gathered into chars
+    char *chars;
+    size_t length;
+    size_t capacity;
+} value_writer;
+
+uint8_t write_value(VM *vm, value_writer *writer, value arg);
 value to_str(VM *vm, value arg);
 value to_num(VM *vm, value arg);
 value to_bool(VM *vm, value arg);
@@ -66,6 +66,9 @@ uint8_t value_equality(value a, value b) {
                     case OBJ_ARRAY:{
                         return array_equality(AS_ARRAY(a), AS_ARRAY(b));
                     }
+                    case OBJ_STRING: {
+                        return string_equality(AS_STRING(a), AS_STRING(b));
+                    }
                     default: return AS_OBJ(a) == AS_OBJ(b);
                 }
             }
@@ -51,6 +51,9 @@ typedef struct object_bound_method object_bound_method;
 typedef struct object_bound_native object_bound_native;
 typedef struct object_namespace object_namespace;
 typedef struct object_exception object_exception;
+typedef struct object_struct object_struct;
+typedef struct object_record object_record;
+typedef struct object_builder object_builder;
 
 typedef struct {
     value_type type;
@@ -11,12 +11,49 @@
 #include "object.h"
 #include "stdlib_canidae.h"
 #include "stdlib_arrays.h"
+#include "stdlib_strings.h"
 #include "type_conversions.h"
+#include "marker.h"
+
+static void release_scratch(VM *vm, size_t base) {
+    while (vm->scratch_count > base) {
+        free_object(vm, vm->scratch[--vm->scratch_count]);
+    }
+}
+
+static void init_stack(VM *vm, size_t bytes) {
+    map_stack(&vm->stack_region, bytes);
+    vm->stack = (value*) vm->stack_region.base;
+    vm->stack_ptr = vm->stack;
+}
+
+void release_stack(VM *vm) {
+    decommit_stack(&vm->stack_region, STACK_LEN(vm) * sizeof(value));
+}
+
+void set_max_depth(VM *vm, uint32_t depth) {
+    vm->max_depth = depth;
+}
+
+void set_stack_size(VM *vm, size_t bytes) { // Only before anything runs, as the stack is remapped
+    unmap_stack(&vm->stack_region);
+    init_stack(vm, bytes);
+}
+
+static void grow_frames(VM *vm) {
+    uint32_t capacity = GROW_CAPACITY(vm->frame_capacity);
+    if (capacity > vm->max_depth) capacity = vm->max_depth;
+    size_t active = vm->frame_count > 0 ? (size_t) (vm->active_frame - vm->frames) : 0;
+    vm->frames = GROW_ARRAY(vm, call_frame, vm->frames, vm->frame_capacity, capacity); // Can collect, which reads the frames before they move
+    vm->frame_capacity = capacity;
+    if (vm->frame_count > 0) vm->active_frame = &vm->frames[active];
+}
 
 static void reset_stack(VM *vm) {
     vm->stack_ptr = vm->stack;
     vm->frame_count = 0;
     vm->open_upvalues = NULL;
+    release_scratch(vm, 0);
 }
 
 void stacktrace(VM *vm) {
@@ -70,6 +107,7 @@ uint8_t runtime_error(VM *vm, error_type type, const char *format, ...) { // Ret
 uint8_t raise(VM *vm, object_exception *exception) { // Returns whether or not the exception is handled (1 is handled, 0 is unhandled)
     if (exception != vm->exception_stack) {
         exception->next = vm->exception_stack;
+        if (exception->next != NULL) write_barrier(vm, (object*) exception, OBJ_VAL(exception->next));
         vm->exception_stack = exception;
     }
 
@@ -97,6 +135,7 @@ uint8_t raise(VM *vm, object_exception *exception) { // Returns whether or not t
         return 0;
     }
     else {
+        release_scratch(vm, catcher->scratch_count_at_try); // Anything frame-local created inside the try block is now unreachable
         vm->frame_count = catcher->frame_at_try;
         vm->active_frame = &vm->frames[vm->frame_count-1];
         vm->stack_ptr -= (STACK_LEN(vm) - catcher->stack_size_at_try);
@@ -108,32 +147,71 @@ uint8_t raise(VM *vm, object_exception *exception) { // Returns whether or not t
     }
 }
 
-void define_native(VM *vm, const char *name, native_function function) {
+static void register_native(VM *vm, const char *name, native_function function, uint8_t gc_safe) {
     push(vm, OBJ_VAL(copy_string(vm, name, strlen(name))));
     push(vm, OBJ_VAL(new_native(vm, function)));
+    AS_NATIVE_OBJ(vm->stack[1])->gc_safe = gc_safe;
     hashmap_set(&vm->globals, vm, AS_STRING(vm->stack[0]), vm->stack[1]);
     popn(vm, 2);
 }
 
+void define_native(VM *vm, const char *name, native_function function) {
+    register_native(vm, name, function, 0);
+}
+
+void define_gc_safe_native(VM *vm, const char *name, native_function function) { // For natives that root their own temporaries with push_root
+    register_native(vm, name, function, 1);
+}
+
 void define_native_global(VM *vm, const char *name, value val) {
     hashmap_set(&vm->globals, vm, copy_string(vm, name, strlen(name)), val);
 }
 
 void init_VM(VM *vm) {
     vm->source_path = NULL;
-    vm->stack = calloc(STACK_INITIAL, sizeof(value));
-    if (vm->stack == NULL) {
-        fprintf(stderr, "Out of memory.");
-    }
+    vm->frames = NULL;
+    vm->frame_count = 0;
+    vm->frame_capacity = 0;
+    vm->max_depth = FRAMES_MAX_DEFAULT;
+    init_stack(vm, STACK_SIZE_DEFAULT);
     vm->long_instruction = 0;
     vm->gc_allowed = 0;
     vm->grey_capacity = 0;
     vm->grey_count = 0;
     vm->grey_stack = NULL;
-    vm->bytes_allocated = STACK_INITIAL*sizeof(value); // Include initial stack allocation in heap allocation
-    vm->gc_threshold = GC_THRESHOLD_INITIAL; // Arbitrary threshold
-    vm->stack_capacity = STACK_INITIAL;
-    vm->objects = NULL;
+    vm->bytes_allocated = 0;
+    vm->gc_config.initial_threshold = GC_THRESHOLD_INITIAL;
+    vm->gc_config.growth_factor = GC_HEAP_GROW_FACTOR;
+    vm->gc_config.min_heap = GC_THRESHOLD_INITIAL;
+    vm->gc_config.max_heap = 0;
+    vm->gc_config.nursery_size = GC_NURSERY_SIZE;
+    vm->gc_config.adaptive = 0;
+    vm->gc_config.target_percent = GC_TARGET_PERCENT_DEFAULT;
+    vm->gc_threshold = GC_NURSERY_SIZE;
+    vm->major_threshold = GC_THRESHOLD_INITIAL;
+    memset(&vm->gc_cycle, 0, sizeof(gc_cycle));
+    vm->gc_cycle.start_ns = gc_now_ns();
+    vm->minors_since_major = 0;
+    vm->gc_phase = GC_IDLE;
+    #ifdef DEBUG_STRESS_GC
+        vm->gc_step_budget = 0; // Smallest possible slices, so marking interleaves with the program as much as it can
+        vm->gc_compact = 1; // Moving objects as often as possible shakes out any reference compaction fails to update
+    #else
+        vm->gc_step_budget = GC_STEP_BUDGET_DEFAULT;
+        vm->gc_compact = 0;
+    #endif
+    vm->pending_work = 0;
+    vm->heap_limit = 0;
+    memset(&vm->gc_stats, 0, sizeof(gc_statistics));
+    vm->gc_threads = 1;
+    vm->markers = NULL;
+    init_heap(&vm->heap);
+    vm->roots = NULL;
+    vm->root_count = 0;
+    vm->root_capacity = 0;
+    vm->scratch = NULL;
+    vm->scratch_count = 0;
+    vm->scratch_capacity = 0;
     vm->owns_strings = 1;
     init_hashmap(&vm->strings);
     init_hashmap(&vm->globals);
@@ -154,9 +232,13 @@ void init_VM(VM *vm) {
     vm->push_string = NULL;
     vm->pop_string = NULL;
     vm->contains_string = NULL;
+    vm->append_string = NULL;
+    vm->build_string = NULL;
     vm->len_string = NULL;
     vm->message_string = NULL;
     vm->type_string = NULL;
+    memset(vm->char_strings, 0, sizeof(vm->char_strings));
+    memset(vm->int_strings, 0, sizeof(vm->int_strings));
     vm->init_string = copy_string(vm, "__init__", 8);
     vm->str_string = copy_string(vm, "__str__", 7);
     vm->num_string = copy_string(vm, "__num__", 7);
@@ -170,21 +252,47 @@ void init_VM(VM *vm) {
     vm->push_string = copy_string(vm, "push", 4);
     vm->pop_string = copy_string(vm, "pop", 3);
     vm->contains_string = copy_string(vm, "contains", 8);
+    vm->append_string = copy_string(vm, "append", 6);
+    vm->build_string = copy_string(vm, "build", 5);
     vm->len_string = copy_string(vm, "__len__", 7);
     vm->message_string = copy_string(vm, "message", 7);
     vm->type_string = copy_string(vm, "type", 4);
+    for (int i = 0; i < 256; i++) {
+        char c = (char) i;
+        vm->char_strings[i] = copy_string(vm, &c, 1);
+    }
 }
 
 void destroy_VM(VM *vm) {
     destroy_hashmap(&vm->strings, vm);
     destroy_hashmap(&vm->globals, vm);
-    free_objects(vm, vm->objects);
-    free(vm->stack);
+    destroy_heap(vm);
+    release_scratch(vm, 0);
+    FREE_ARRAY(vm, object*, vm->scratch, vm->scratch_capacity);
+    free(vm->roots);
+    unmap_stack(&vm->stack_region);
+    FREE_ARRAY(vm, call_frame, vm->frames, vm->frame_capacity);
     free(vm->grey_stack);
+    if (vm->markers != NULL) stop_markers(vm->markers);
     vm->init_string = NULL;
 }
 
 
+void set_gc_config(VM *vm, const gc_config *config) { // Takes effect from the next collection onwards
+    vm->gc_config = *config;
+    vm->gc_threshold = vm->bytes_allocated + config->nursery_size;
+    if (vm->gc_stats.major_collections == 0) vm->major_threshold = config->initial_threshold;
+}
+
+void enable_arena(VM *vm, size_t cap) { // Objects allocated from here on are bump-allocated and never collected, until cap bytes if it isn't 0
+    vm->heap.arena = 1;
+    vm->heap.arena_cap = cap;
+}
+
+void set_heap_limit(VM *vm, size_t bytes) {
+    vm->heap_limit = bytes;
+}
+
 void enable_gc(VM *vm) {
     vm->gc_allowed = 1;
 }
@@ -193,34 +301,7 @@ void disable_gc(VM *vm) {
     vm->gc_allowed = 0;
 }
 
-void resize_stack(VM *vm, size_t target_size) {
-    disable_gc(vm);
-    size_t oldc = vm->stack_capacity;
-    size_t len = STACK_LEN(vm);
-    vm->stack_capacity = target_size;
-    value *stack_old = vm->stack;
-    vm->stack = GROW_ARRAY(vm, value, vm->stack, oldc, vm->stack_capacity);
-    vm->stack_ptr = &(vm->stack[len]);
-    if (vm->stack != stack_old) { // If realloc has moved the stack, we need to update all pointers to the stack in upvalues and call frames
-        for (size_t i = 0; i < vm->frame_count; i++) { // Moves stack frames to meet the new stack size
-            call_frame *frame = &vm->frames[i];
-            frame->slots = &(vm->stack[frame->slot_offset]);
-        }
-        object_upvalue *upval = vm->open_upvalues;
-        while (upval != NULL) {
-            if (&upval->closed != upval->location) { // If not closed, location must be on the stack
-                upval->location = vm->stack + (upval->location - stack_old); // Calculate new pointer to location on stack
-            }
-            upval = upval->next; // Move onto the next upvalue
-        }
-    }
-    enable_gc(vm);
-}
-
-void push(VM *vm, value val) {
-    if (STACK_LEN(vm) >= vm->stack_capacity) {
-        resize_stack(vm, GROW_CAPACITY(vm->stack_capacity));
-    }
+void push(VM *vm, value val) { // No capacity check - the stack is committed on demand, and overflowing it hits the guard page (see run_guarded)
     *vm->stack_ptr = val;
     vm->stack_ptr++;
 }
@@ -317,16 +398,18 @@ static uint8_t call(VM *vm, object_closure *closure, uint8_t argc) {
     if (argc != closure->function->arity) {
         return runtime_error(vm, ARGUMENT_ERROR, "Function '%s' expects %u arguments (got %u).", closure->function->name->chars, closure->function->arity, argc);
     }
-    if (vm->frame_count == FRAMES_MAX) {
-        return runtime_error(vm, RECURSION_ERROR, "Exceeded max call depth (%u).", FRAMES_MAX);
+    if (vm->frame_count == vm->max_depth) {
+        return runtime_error(vm, RECURSION_ERROR, "Exceeded max call depth (%u).", vm->max_depth);
     }
+    if (vm->frame_count == vm->frame_capacity) grow_frames(vm);
     call_frame *frame = &vm->frames[vm->frame_count++];
     frame->closure = closure;
     frame->ip = closure->function->seg.bytecode;
     frame->slots = vm->stack_ptr - argc - 1;
-    frame->slot_offset = STACK_LEN(vm) - argc -1;
     frame->is_module_frame = 0;
     frame->saved_source_path = NULL;
+    frame->scratch_base = vm->scratch_count;
+    frame->wanted = 1; // Calls made from bytecode replace this with their values-wanted operand
     return 1;
 }
 
@@ -337,9 +420,17 @@ static uint8_t call_value(VM *vm, value callee, uint8_t argc) {
                 return call(vm, AS_CLOSURE(callee), argc);
             }
             case OBJ_NATIVE: {
-                native_function native = AS_NATIVE(callee);
+                object_native *native = AS_NATIVE_OBJ(callee);
+                if (native->gc_safe) {
+                    value result = native->function(vm, argc, vm->stack_ptr - argc);
+                    if (IS_NATIVE_ERROR(result)) return 0;
+                    if (IS_HANDLED_NATIVE_ERROR(result)) return 1;
+                    vm->stack_ptr -= argc + 1;
+                    push(vm, result);
+                    return 1;
+                }
                 disable_gc(vm); // Disables gc during native function in case native function doesn't have gc-safe (i.e. push objects to stack) code
-                value result = native(vm, argc, vm->stack_ptr - argc);
+                value result = native->function(vm, argc, vm->stack_ptr - argc);
                 enable_gc(vm); // Re-enables afterwards
                 if (IS_NATIVE_ERROR(result)) return 0;
                 if (IS_HANDLED_NATIVE_ERROR(result)) return 1;
@@ -351,29 +442,36 @@ static uint8_t call_value(VM *vm, value callee, uint8_t argc) {
             case OBJ_CLASS: {
                 object_class *class_ = AS_CLASS(callee);
                 vm->stack_ptr[-argc - 1] = OBJ_VAL(new_instance(vm, class_));
-                value initialiser;
-                if(hashmap_get(&class_->methods, vm->init_string, &initialiser)) {
-                    return call(vm, AS_CLOSURE(initialiser), argc);
+                if (class_->initialiser != NULL) {
+                    return call(vm, class_->initialiser, argc);
                 } else if (argc != 0) {
                     return runtime_error(vm, ARGUMENT_ERROR, "Expected 0 arguments (got %u).", argc);
                 }
                 return 1;
             }
+            case OBJ_STRUCT: {
+                object_struct *type = AS_STRUCT(callee);
+                if (argc != type->field_count) {
+                    return runtime_error(vm, ARGUMENT_ERROR, "Expected %u arguments (got %u).", type->field_count, argc);
+                }
+                object_record *record = new_record(vm, type, vm->stack_ptr - argc); // Arguments are the fields in declaration order
+                vm->stack_ptr -= argc + 1;
+                push(vm, OBJ_VAL(record));
+                return 1;
+            }
             case OBJ_BOUND_METHOD: {
                 object_bound_method *bound = AS_BOUND_METHOD(callee);
                 vm->stack_ptr[-argc - 1] = bound->receiver;
                 return call(vm, bound->method, argc);
             }
             case OBJ_BOUND_NATIVE: {
-                object_bound_native *bound = AS_BOUND_NATIVE(callee);
-                disable_gc(vm);
+                object_bound_native *bound = AS_BOUND_NATIVE(callee); // Only array methods, which are all GC-safe
+                vm->stack_ptr[-argc - 1] = bound->receiver; // Keeps the receiver reachable once the bound native itself isn't
                 value result = bound->function(vm, bound->receiver, argc, vm->stack_ptr - argc);
-                enable_gc(vm);
                 if (IS_NATIVE_ERROR(result)) return 0;
                 if (IS_HANDLED_NATIVE_ERROR(result)) return 1;
                 vm->stack_ptr -= argc + 1;
                 push(vm, result);
-                FREE(vm, char, ALLOCATE(vm, char, 1));
                 return 1;
             }
             default: {
@@ -384,15 +482,42 @@ static uint8_t call_value(VM *vm, value callee, uint8_t argc) {
     return runtime_error(vm, TYPE_ERROR, "Can only call functions.");
 }
 
-static uint8_t invoke_from_class(VM *vm, object_class *class_, object_string *name, uint8_t argc) {
-    value method;
-    if (!hashmap_get(&class_->methods, name, &method)) {
+static object_closure *cached_method(object_class *class_, object_string *name, uint8_t *cache) {
+    // The cache is 4 bytes of class id then 3 bytes of slot, zeroed by the compiler
+    uint32_t cached_id = ((uint32_t) cache[0] << 24) + ((uint32_t) cache[1] << 16) + ((uint32_t) cache[2] << 8) + (uint32_t) cache[3];
+    if (cached_id == class_->id) {
+        return class_->vtable[((uint32_t) cache[4] << 16) + ((uint32_t) cache[5] << 8) + (uint32_t) cache[6]];
+    }
+    uint32_t slot;
+    if (!find_method_slot(class_, name, &slot)) return NULL;
+    if (slot < (1 << 24)) { // Slots are fixed once assigned so the cache stays valid for as long as the class is the same
+        uint8_t bytes[7] = {class_->id >> 24, class_->id >> 16, class_->id >> 8, class_->id, slot >> 16, slot >> 8, slot};
+        memcpy(cache, bytes, 7);
+    }
+    return class_->vtable[slot];
+}
+
+static uint8_t record_field(VM *vm, object_record *record, object_string *name, long *slot) {
+    // Resolves name to a field of record, trying the compiler's guess in *slot first (-1 for no guess)
+    // Returns 0 for an unhandled NameError, and leaves *slot at -1 if a NameError was raised and caught
+    object_struct *type = record->type;
+    if (*slot >= 0 && *slot < type->field_count && type->field_names[*slot] == name) return 1;
+    *slot = struct_field_slot(type, name);
+    if (*slot == -1) {
+        return runtime_error(vm, NAME_ERROR, "Struct '%s' has no field '%s'.", type->name->chars, name->chars);
+    }
+    return 1;
+}
+
+static uint8_t invoke_from_class(VM *vm, object_class *class_, object_string *name, uint8_t argc, uint8_t *cache) {
+    object_closure *method = cached_method(class_, name, cache);
+    if (method == NULL) {
         return runtime_error(vm, NAME_ERROR, "Undefined property '%s'.", name->chars);
     }
-    return call(vm, AS_CLOSURE(method), argc);
+    return call(vm, method, argc);
 }
 
-static uint8_t invoke(VM *vm, object_string *name, uint8_t argc) {
+static uint8_t invoke(VM *vm, object_string *name, uint8_t argc, uint8_t *cache) {
     value receiver = peek(vm, argc);
 
     if (IS_NAMESPACE(receiver)) {
@@ -415,17 +540,38 @@ static uint8_t invoke(VM *vm, object_string *name, uint8_t argc) {
         if (fn == NULL) {
             return runtime_error(vm, NAME_ERROR, "Arrays do not have method '%s'.", name->chars);
         }
-        disable_gc(vm);
+        value result = fn(vm, receiver, argc, vm->stack_ptr - argc); // The receiver is still on the stack, so the array methods can let the GC run
+        if (IS_NATIVE_ERROR(result)) return 0;
+        if (IS_HANDLED_NATIVE_ERROR(result)) return 1;
+        vm->stack_ptr -= argc + 1;
+        push(vm, result);
+        return 1;
+    }
+
+    if (IS_BUILDER(receiver)) {
+        bound_native_function fn = NULL;
+        if (name == vm->append_string) fn = builder_append_native;
+        else if (name == vm->build_string) fn = builder_build_native;
+        if (fn == NULL) {
+            return runtime_error(vm, NAME_ERROR, "String builders do not have method '%s'.", name->chars);
+        }
         value result = fn(vm, receiver, argc, vm->stack_ptr - argc);
-        enable_gc(vm);
         if (IS_NATIVE_ERROR(result)) return 0;
         if (IS_HANDLED_NATIVE_ERROR(result)) return 1;
         vm->stack_ptr -= argc + 1;
         push(vm, result);
-        FREE(vm, char, ALLOCATE(vm, char, 1));
         return 1;
     }
 
+    if (IS_RECORD(receiver)) {
+        object_record *record = AS_RECORD(receiver);
+        long slot = -1;
+        uint8_t ok = record_field(vm, record, name, &slot);
+        if (slot == -1) return ok;
+        vm->stack_ptr[-argc - 1] = record->fields[slot];
+        return call_value(vm, record->fields[slot], argc);
+    }
+
     if (!IS_INSTANCE(receiver)) {
         return runtime_error(vm, TYPE_ERROR, "Only instances and namespaces have methods or functions.");
     }
@@ -438,16 +584,16 @@ static uint8_t invoke(VM *vm, object_string *name, uint8_t argc) {
         return call_value(vm, v, argc);
     }
 
-    return invoke_from_class(vm, instance->class_, name, argc);
+    return invoke_from_class(vm, instance->class_, name, argc, cache);
 }
 
 static uint8_t bind_method(VM *vm, object_class *class_, object_string *name, uint8_t keep_ref) {
-    value method;
-    if (!hashmap_get(&class_->methods, name, &method)) {
+    object_closure *method = find_method(class_, name);
+    if (method == NULL) {
         return 0;
     }
 
-    object_bound_method *bound = new_bound_method(vm, peek(vm, 0), AS_CLOSURE(method));
+    object_bound_method *bound = new_bound_method(vm, peek(vm, 0), method);
     if (!keep_ref) pop(vm);
     push(vm, OBJ_VAL(bound));
     return 1;
@@ -480,17 +626,39 @@ static void close_upvalues(VM *vm, value *last) {
         object_upvalue *upval = vm->open_upvalues;
         upval->closed = *upval->location;
         upval->location = &upval->closed;
+        write_barrier(vm, (object*) upval, upval->closed);
         vm->open_upvalues = upval->next;
     }
 }
 
 static void define_method(VM *vm, object_string *name) {
-    value method = peek(vm, 0);
+    object_closure *method = AS_CLOSURE(peek(vm, 0));
     object_class *class_ = AS_CLASS(peek(vm, 1));
-    hashmap_set(&class_->methods, vm, name, method);
+    uint32_t slot;
+    if (!find_method_slot(class_, name, &slot)) { // New name, so it gets the next free slot - overrides keep their parent's slot
+        slot = class_->method_count;
+        if (class_->method_count >= class_->vtable_capacity) {
+            uint32_t oldc = class_->vtable_capacity;
+            class_->vtable_capacity = GROW_CAPACITY(oldc);
+            class_->vtable = GROW_ARRAY(vm, object_closure*, class_->vtable, oldc, class_->vtable_capacity);
+        }
+        hashmap_set(&class_->slots, vm, name, NUMBER_VAL((double) slot));
+        class_->method_count++;
+    }
+    class_->vtable[slot] = method;
+    if (name == vm->init_string) class_->initialiser = method;
+    write_barrier(vm, (object*) class_, OBJ_VAL(method));
+    write_barrier(vm, (object*) class_, OBJ_VAL(name));
     pop(vm);
 }
 
+static void seal_class(VM *vm, object_class *class_) {
+    if (class_->vtable_capacity > class_->method_count) { // No more methods can be added, so trim the vtable down to size
+        class_->vtable = GROW_ARRAY(vm, object_closure*, class_->vtable, class_->vtable_capacity, class_->method_count);
+        class_->vtable_capacity = class_->method_count;
+    }
+}
+
 uint8_t is_falsey(value v) {
     return IS_NULL(v) || (IS_BOOL(v) && !AS_BOOL(v)) || (IS_NUMBER(v) && AS_NUMBER(v) == 0) || (IS_STRING(v) && AS_STRING(v)->length == 0) || (IS_ARRAY(v) && AS_ARRAY(v)->arr.len == 0) || IS_UNDEFINED(v);
 }
@@ -505,11 +673,7 @@ static uint8_t concatenate(VM *vm) {
                 runtime_error(vm, MEMORY_ERROR, "String concatenation results in string larger than max string size.");
                 return INTERPRET_RUNTIME_ERROR;
             }
-            char *chars = ALLOCATE(vm, char, len + 1);
-            memcpy(chars, a->chars, a->length);
-            memcpy(chars + a->length, b->chars, b->length);
-            chars[len] = '\0';
-            object_string *result = take_string(vm, chars, len);
+            object_string *result = concatenate_strings(vm, a, b); // Long results are ropes, so building a string up piece by piece is linear
             popn(vm, 2);
             push(vm, OBJ_VAL(result));
             break;
@@ -535,20 +699,36 @@ static uint8_t concatenate(VM *vm) {
     return INTERPRET_OK;
 }
 
+static uint8_t unpack_error(VM *vm, uint8_t wanted, uint8_t got) {
+    return runtime_error(vm, VALUE_ERROR, "Expected %u value%s (got %u).", wanted, wanted == 1 ? "" : "s", got);
+}
+
+static uint8_t expect_values(VM *vm, uint32_t depth, uint8_t *resume, uint8_t wanted) {
+    // Hands a call's values-wanted operand to the frame it pushed, or checks it against the single value anything else produces
+    if (wanted == RETURNS_FORWARD) wanted = vm->frames[depth - 1].wanted;
+    if (vm->frame_count > depth) {
+        vm->frames[vm->frame_count - 1].wanted = wanted;
+        return 1;
+    }
+    if (wanted <= 1 || vm->frame_count < depth || vm->frames[depth - 1].ip != resume) return 1; // One value, or an exception was raised and caught
+    return unpack_error(vm, wanted, 1);
+}
+
 static uint8_t convert_type(VM *vm, value converter(VM*, value), object_string *override_function) {
     value v = peek(vm, 0);
     uint8_t is_instance = IS_INSTANCE(v);
     uint8_t overridden = 0;
     if (is_instance) {
         object_instance *instance = AS_INSTANCE(v);
-        value method;
-        if (hashmap_get(&instance->class_->methods, override_function, &method)) {
-            return call(vm, AS_CLOSURE(method), 0);
+        object_closure *method = find_method(instance->class_, override_function);
+        if (method != NULL) {
+            return call(vm, method, 0);
         }
     }
     if (!is_instance || !overridden) {
         value converted = converter(vm, v);
         if (IS_NATIVE_ERROR(converted)) return 0;
+        if (IS_HANDLED_NATIVE_ERROR(converted)) return 1; // The handler has already reset the stack
         pop(vm);
         push(vm, converted);
         return 1;
@@ -597,7 +777,8 @@ static uint8_t vm_array_get(VM *vm, uint8_t keep_ref) {
             if (index_int >= string->length) {
                 return runtime_error(vm, INDEX_ERROR, "Index %lu exceeds max index of string (%lu).", index_int, string->length-1);
             }
-            object_string *result = copy_string(vm, &string->chars[index_int], 1);
+            flatten_string(vm, string);
+            object_string *result = vm->char_strings[(uint8_t) string->chars[index_int]];
             popn(vm, 2);
             push(vm, OBJ_VAL(result));
             break;
@@ -609,6 +790,78 @@ static uint8_t vm_array_get(VM *vm, uint8_t keep_ref) {
     return 1;
 }
 
+static object_closure *resolve_super(VM *vm, object_class *superclass, object_string *name) {
+    uint8_t *cache = vm->active_frame->ip; // Inline cache after the operands
+    vm->active_frame->ip += 7;
+    return cached_method(superclass, name, cache);
+}
+
+static size_t switch_target(switch_table *t, value v) {
+    switch (t->kind) {
+        case SWITCH_DENSE: {
+            if (!IS_NUMBER(v)) break;
+            double d = AS_NUMBER(v);
+            if (!(d >= t->dense_min && d < (double) t->dense_min + t->dense_len)) break; // Written so that NaN fails it too
+            long index = (long) d - t->dense_min;
+            if ((double) (index + t->dense_min) != d) break; // Non-integral values never match
+            return t->dense_targets[index];
+        }
+        case SWITCH_ERROR: {
+            if (!IS_ERROR_TYPE(v)) break;
+            return t->dense_targets[AS_ERROR_TYPE(v)];
+        }
+        case SWITCH_STRING: {
+            if (!IS_STRING(v)) break;
+            uint32_t index = string_hash(AS_STRING(v)) & (t->case_capacity - 1); // Ropes are flattened beforehand
+            while (!IS_NULL(t->cases[index].key)) {
+                if (string_equality(AS_STRING(t->cases[index].key), AS_STRING(v))) return t->cases[index].target;
+                index = (index + 1) & (t->case_capacity - 1);
+            }
+            break;
+        }
+        case SWITCH_SPARSE: {
+            if (!IS_NUMBER(v)) break;
+            double d = AS_NUMBER(v);
+            uint32_t lo = 0, hi = t->case_capacity;
+            while (lo < hi) {
+                uint32_t mid = lo + (hi - lo) / 2;
+                double key = AS_NUMBER(t->cases[mid].key);
+                if (key == d) return t->cases[mid].target;
+                if (key < d) lo = mid + 1;
+                else hi = mid;
+            }
+            break;
+        }
+        case SWITCH_GENERIC: {
+            for (uint32_t i = 0; i < t->case_capacity; i++) {
+                if (value_equality(t->cases[i].key, v)) return t->cases[i].target;
+            }
+            break;
+        }
+    }
+    return t->default_target;
+}
+
+typedef enum {
+    SAFE_POINT_CONTINUE,
+    SAFE_POINT_HANDLED, // An error was raised and caught, so execution resumes at the handler
+    SAFE_POINT_UNHANDLED,
+} safe_point_result;
+
+static safe_point_result safe_point(VM *vm) { // Loop back edges and calls, where nothing but the VM itself holds object pointers
+    if (vm->pending_work & PENDING_COMPACTION) compact_heap(vm);
+    if (vm->pending_work & PENDING_MEMORY_ERROR) {
+        if (!heap_over_limit(vm)) {
+            vm->pending_work &= ~PENDING_MEMORY_ERROR;
+            return SAFE_POINT_CONTINUE;
+        }
+        uint8_t handled = runtime_error(vm, MEMORY_ERROR, "Heap limit of %zu bytes exceeded.", vm->heap_limit);
+        vm->pending_work &= ~PENDING_MEMORY_ERROR; // Only cleared now so allocating the error can't queue up another
+        return handled ? SAFE_POINT_HANDLED : SAFE_POINT_UNHANDLED;
+    }
+    return SAFE_POINT_CONTINUE;
+}
+
 static interpret_result run(VM *vm) {
     vm->active_frame = &vm->frames[vm->frame_count - 1];
     #define READ_BYTE() (*vm->active_frame->ip++)
@@ -625,9 +878,9 @@ static interpret_result run(VM *vm) {
                 uint8_t overriden = 0; \
                 if (IS_INSTANCE(peek(vm, 1))) { \
                     object_instance *instance = AS_INSTANCE(peek(vm, 1)); \
-                    value v; \
-                    if (hashmap_get(&instance->class_->methods, override, &v)) { \
-                        overriden = call(vm, AS_CLOSURE(v), 1); \
+                    object_closure *method = find_method(instance->class_, override); \
+                    if (method != NULL) { \
+                        overriden = call(vm, method, 1); \
                         vm->active_frame = &vm->frames[vm->frame_count-1]; \
                     } \
                 } \
@@ -665,6 +918,8 @@ static interpret_result run(VM *vm) {
                     } \
                     switch (GET_OBJ_TYPE(a)) { \
                         case OBJ_STRING: { \
+                            flatten_string(vm, AS_STRING(a)); \
+                            flatten_string(vm, AS_STRING(b)); \
                             popn(vm, 2); \
                             push(vm, BOOL_VAL(string_comparison(AS_STRING(a), AS_STRING(b)) op 0)); \
                             break; \
@@ -699,8 +954,10 @@ static interpret_result run(VM *vm) {
             case OP_RETURN:{
                 value result = pop(vm);
                 close_upvalues(vm, vm->active_frame->slots);
+                release_scratch(vm, vm->active_frame->scratch_base);
                 uint8_t is_mod = vm->active_frame->is_module_frame;
                 char *saved_path = vm->active_frame->saved_source_path;
+                uint8_t wanted = vm->active_frame->wanted;
                 vm->frame_count--;
                 if (vm->frame_count == 0) {
                     pop(vm);
@@ -708,9 +965,37 @@ static interpret_result run(VM *vm) {
                     return INTERPRET_OK;
                 }
                 vm->stack_ptr = vm->active_frame->slots;
-                push(vm, result);
                 if (is_mod) { free(vm->source_path); vm->source_path = saved_path; }
                 vm->active_frame = &vm->frames[vm->frame_count - 1];
+                if (wanted > 1) {
+                    if (!unpack_error(vm, wanted, 1)) return INTERPRET_RUNTIME_ERROR;
+                    continue;
+                }
+                push(vm, result);
+                break;
+            }
+            case OP_RETURN_MULTI: {
+                uint8_t count = READ_BYTE();
+                uint8_t wanted = vm->active_frame->wanted;
+                if (count == 0) count = wanted == RETURNS_ANY ? 1 : wanted; // Forwarding a call's values, already checked against what's wanted
+                close_upvalues(vm, vm->active_frame->slots);
+                release_scratch(vm, vm->active_frame->scratch_base);
+                uint8_t is_mod = vm->active_frame->is_module_frame;
+                char *saved_path = vm->active_frame->saved_source_path;
+                value *results = vm->stack_ptr - count;
+                value *dest = vm->active_frame->slots;
+                vm->frame_count--;
+                call_frame *caller = &vm->frames[vm->frame_count - 1];
+                if (wanted == RETURNS_ANY) wanted = count = 1; // Discarded anyway, so just the first is kept for the caller to pop
+                if (is_mod) { free(vm->source_path); vm->source_path = saved_path; }
+                vm->active_frame = caller;
+                if (count != wanted) {
+                    vm->stack_ptr = dest;
+                    if (!unpack_error(vm, wanted, count)) return INTERPRET_RUNTIME_ERROR;
+                    continue;
+                }
+                memmove(dest, results, count * sizeof(value)); // Straight into the caller's locals when it's destructuring
+                vm->stack_ptr = dest + count;
                 break;
             }
             case OP_NEGATE:
@@ -737,9 +1022,9 @@ static interpret_result run(VM *vm) {
                     uint8_t overriden = 0;
                     if (IS_INSTANCE(peek(vm, 1))) {
                         object_instance *instance = AS_INSTANCE(peek(vm, 1));
-                        value v;
-                        if (hashmap_get(&instance->class_->methods, vm->pow_string, &v)) {
-                            overriden = call(vm, AS_CLOSURE(v), 1);
+                        object_closure *method = find_method(instance->class_, vm->pow_string);
+                        if (method != NULL) {
+                            overriden = call(vm, method, 1);
                             vm->active_frame = &vm->frames[vm->frame_count-1];
                         }
                     }
@@ -760,9 +1045,9 @@ static interpret_result run(VM *vm) {
                     uint8_t overriden = 0;
                     if (IS_INSTANCE(peek(vm, 1))) {
                         object_instance *instance = AS_INSTANCE(peek(vm, 1));
-                        value v;
-                        if (hashmap_get(&instance->class_->methods, vm->mod_string, &v)) {
-                            overriden = call(vm, AS_CLOSURE(v), 1);
+                        object_closure *method = find_method(instance->class_, vm->mod_string);
+                        if (method != NULL) {
+                            overriden = call(vm, method, 1);
                             vm->active_frame = &vm->frames[vm->frame_count-1];
                         }
                     }
@@ -794,10 +1079,24 @@ static interpret_result run(VM *vm) {
             case OP_LESS: BINARY_COMPARISON(BOOL_VAL, <); break;
             case OP_LESS_EQUAL: BINARY_COMPARISON(BOOL_VAL, <=); break;
             case OP_PRINT: {
-                print_value(pop(vm));
+                value_writer writer = {stdout, NULL, 0, 0}; // Streamed, so printing a large array never builds its string
+                if (!write_value(vm, &writer, peek(vm, 0))) {
+                    if (!runtime_error(vm, TYPE_ERROR, "Unprintable object type (how did you even access this?)")) return INTERPRET_RUNTIME_ERROR;
+                    continue;
+                }
+                pop(vm);
                 printf("\n");
                 break;
             }
+            case OP_STR_OVERRIDE: {
+                value v = peek(vm, 0);
+                if (!IS_INSTANCE(v)) break;
+                object_closure *method = find_method(AS_INSTANCE(v)->class_, vm->str_string);
+                if (method == NULL) break;
+                if (!call(vm, method, 0)) return INTERPRET_RUNTIME_ERROR;
+                vm->active_frame = &vm->frames[vm->frame_count-1];
+                break;
+            }
             case OP_POP: pop(vm); break;
             case OP_ARRAY_GET: {
                 if(!vm_array_get(vm, 0)) {
@@ -844,15 +1143,22 @@ static interpret_result run(VM *vm) {
                     push(vm, OBJ_VAL(allocate_array(vm, NULL, 0)));
                     break;
                 }
-                value *values = calloc(arr_size, sizeof(value));
-                for (long i = arr_size-1; i >= 0; i--) {
-                    values[i] = peek(vm, arr_size-1-i);
-                }
+                value *values = ALLOCATE(vm, value, arr_size);
+                memcpy(values, vm->stack_ptr - arr_size, arr_size * sizeof(value));
                 object_array *array = allocate_array(vm, values, arr_size);
                 popn(vm, arr_size);
                 push(vm, OBJ_VAL(array));
                 break;
             }
+            case OP_MAKE_ARRAY_SCRATCH: {
+                size_t arr_size = (size_t) AS_NUMBER(pop(vm));
+                value *values = ALLOCATE(vm, value, arr_size);
+                memcpy(values, vm->stack_ptr - arr_size, arr_size * sizeof(value));
+                object_array *array = allocate_scratch_array(vm, values, arr_size);
+                popn(vm, arr_size);
+                push(vm, OBJ_VAL(array));
+                break;
+            }
             case OP_CLOSE_UPVALUE: {
                 close_upvalues(vm, vm->stack_ptr - 1);
                 pop(vm);
@@ -869,7 +1175,16 @@ static interpret_result run(VM *vm) {
                     if(!runtime_error(vm, TYPE_ERROR, "Can only inherit from class.")) return INTERPRET_RUNTIME_ERROR;
                     continue;
                 }
-                hashmap_copy_all(vm, &AS_CLASS(superclass)->methods, &subclass->methods);
+                object_class *parent = AS_CLASS(superclass);
+                subclass->superclass = parent; // The subclass shares the parent's slot assignments rather than copying its method table
+                if (parent->method_count > 0) {
+                    subclass->vtable = ALLOCATE(vm, object_closure*, parent->method_count);
+                    memcpy(subclass->vtable, parent->vtable, parent->method_count * sizeof(object_closure*));
+                    subclass->vtable_capacity = parent->method_count;
+                    subclass->method_count = parent->method_count;
+                }
+                subclass->initialiser = parent->initialiser;
+                write_barrier(vm, (object*) subclass, superclass); // The vtable entries hang off the parent, so they're no younger than it
                 pop(vm); // Pops subclass
                 break;
             }
@@ -890,6 +1205,13 @@ static interpret_result run(VM *vm) {
                             case OBJ_CLOSURE:
                                 pop(vm); push(vm, TYPE_VAL(TYPEOF_FUNCTION)); break;
                             case OBJ_NAMESPACE: pop(vm); push(vm, TYPE_VAL(TYPEOF_NAMESPACE)); break;
+                            case OBJ_STRUCT: pop(vm); push(vm, TYPE_VAL(TYPEOF_CLASS)); break;
+                            case OBJ_RECORD: {
+                                object_record *record = AS_RECORD(v);
+                                pop(vm);
+                                push(vm, OBJ_VAL(record->type));
+                                break;
+                            }
                             case OBJ_INSTANCE: {
                                 object_instance *instance = AS_INSTANCE(v);
                                 pop(vm);
@@ -929,9 +1251,9 @@ static interpret_result run(VM *vm) {
                         }
                         case OBJ_INSTANCE: {
                             object_instance *instance = AS_INSTANCE(v);
-                            value v;
-                            if (hashmap_get(&instance->class_->methods, vm->len_string, &v)) {
-                                result = call(vm, AS_CLOSURE(v), 0);
+                            object_closure *method = find_method(instance->class_, vm->len_string);
+                            if (method != NULL) {
+                                result = call(vm, method, 0);
                                 vm->active_frame = &vm->frames[vm->frame_count-1];
                             }
                         }
@@ -969,6 +1291,7 @@ static interpret_result run(VM *vm) {
             case OP_IMPORT: {
                 object_string *namespace_name = READ_STRING(READ_VARIABLE_CONST());
                 object_string *filename = AS_STRING(peek(vm, 0));
+                flatten_string(vm, filename);
 
                 char *final_path = NULL;
                 char *source = read_import_file(vm, filename->chars, &final_path);
@@ -1002,6 +1325,13 @@ static interpret_result run(VM *vm) {
                 vm->active_frame = &vm->frames[vm->frame_count - 1];
                 break;
             }
+            case OP_RELEASE_SCRATCH: {
+                value v = vm->active_frame->slots[READ_VARIABLE_ARG()];
+                if (vm->scratch_count > vm->active_frame->scratch_base && IS_OBJ(v) && AS_OBJ(v) == vm->scratch[vm->scratch_count-1]) {
+                    release_scratch(vm, vm->scratch_count - 1); // Only the most recent frame-local object can be released early - anything else waits for the frame to return
+                }
+                break;
+            }
             case OP_BUILD_NAMESPACE: {
                 uint8_t n = READ_BYTE();
                 object_string *ns_name = copy_string(vm, "module", 6);
@@ -1012,6 +1342,7 @@ static interpret_result run(VM *vm) {
                     object_string *name = READ_STRING(READ_CONSTANT_LONG());
                     value val = vm->active_frame->slots[slot_idx];
                     hashmap_set(&ns->values, vm, name, val);
+                    write_barrier(vm, (object*) ns, val);
                 }
                 break;
             }
@@ -1025,8 +1356,16 @@ static interpret_result run(VM *vm) {
                 break;
             }
             case OP_CALL: {
+                if (vm->pending_work) { // Recursion without loops still reaches a safe point
+                    safe_point_result result = safe_point(vm);
+                    if (result == SAFE_POINT_UNHANDLED) return INTERPRET_RUNTIME_ERROR;
+                    if (result == SAFE_POINT_HANDLED) break; // The handler runs instead of the call
+                }
                 uint8_t argc = READ_BYTE();
-                if (!call_value(vm, peek(vm, argc), argc)) {
+                uint8_t wanted = READ_BYTE();
+                uint32_t depth = vm->frame_count;
+                uint8_t *resume = vm->active_frame->ip;
+                if (!call_value(vm, peek(vm, argc), argc) || !expect_values(vm, depth, resume, wanted)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 vm->active_frame = &vm->frames[vm->frame_count - 1];
@@ -1040,8 +1379,7 @@ static interpret_result run(VM *vm) {
             case OP_CONV_TYPE: {
                 uint8_t arg = READ_BYTE();
                 uint8_t result = 0;
-                disable_gc(vm);
-                switch (arg) {
+                switch (arg) { // The converters root anything they allocate along the way, so the GC can run during them
                     case TYPEOF_NUM: {
                         result = convert_type(vm, to_num, vm->num_string);
                         break;
@@ -1056,7 +1394,6 @@ static interpret_result run(VM *vm) {
                     }
                     default: break; // Should be unreachable
                 }
-                enable_gc(vm);
                 if (!result) return INTERPRET_RUNTIME_ERROR;
                 vm->active_frame = &vm->frames[vm->frame_count-1];
                 break;
@@ -1099,7 +1436,9 @@ static interpret_result run(VM *vm) {
                 break;
             }
             case OP_SET_UPVALUE: {
-                *vm->active_frame->closure->upvalues[READ_VARIABLE_ARG()]->location = peek(vm, 0);
+                object_upvalue *upvalue = vm->active_frame->closure->upvalues[READ_VARIABLE_ARG()];
+                *upvalue->location = peek(vm, 0);
+                write_barrier(vm, (object*) upvalue, peek(vm, 0));
                 break;
             }
             case OP_JUMP_IF_FALSE: {
@@ -1125,20 +1464,24 @@ static interpret_result run(VM *vm) {
             case OP_LOOP: {
                 uint64_t offset = READ_UINT40();
                 vm->active_frame->ip -= offset;
+                if (vm->pending_work && safe_point(vm) == SAFE_POINT_UNHANDLED) return INTERPRET_RUNTIME_ERROR;
                 break;
             }
-            case OP_CLOSURE: {
+            case OP_CLOSURE:
+            case OP_CLOSURE_SCRATCH: {
                 object_function *function = AS_FUNCTION(READ_CONSTANT_LONG());
-                object_closure *closure = new_closure(vm, function);
+                object_closure *closure = instruction == OP_CLOSURE ? new_closure(vm, function) : new_scratch_closure(vm, function);
                 push(vm, OBJ_VAL(closure));
                 for (uint32_t i = 0; i < closure->upvalue_count; i++) {
                     uint8_t is_local = READ_BYTE();
                     uint32_t index = READ_UINT24();
                     if (is_local) {
                         closure->upvalues[i] = capture_upvalue(vm, vm->active_frame->slots + index);
+                        write_barrier(vm, (object*) closure, OBJ_VAL(closure->upvalues[i])); // Capturing can collect, which would have made the closure old
                     }
                     else {
                         closure->upvalues[i] = vm->active_frame->closure->upvalues[index];
+                        write_barrier(vm, (object*) closure, OBJ_VAL(closure->upvalues[i]));
                     }
                 }
                 break;
@@ -1147,8 +1490,45 @@ static interpret_result run(VM *vm) {
                 push(vm, OBJ_VAL(new_class(vm, READ_STRING(READ_VARIABLE_CONST()))));
                 break;
             }
+            case OP_GET_FIELD: {
+                uint8_t slot = READ_BYTE();
+                if (IS_RECORD(peek(vm, 0))) {
+                    object_record *record = AS_RECORD(peek(vm, 0));
+                    object_string *name = READ_STRING(READ_VARIABLE_CONST());
+                    long found = slot;
+                    if (!record_field(vm, record, name, &found)) return INTERPRET_RUNTIME_ERROR;
+                    if (found == -1) continue;
+                    vm->stack_ptr[-1] = record->fields[found];
+                    break;
+                }
+                // Not a record, so the remaining operands are exactly those of OP_GET_PROPERTY
+            }
+            // fall through
             case OP_GET_PROPERTY: {
                 value obj = peek(vm, 0);
+                if (IS_RECORD(obj)) {
+                    object_record *record = AS_RECORD(obj);
+                    object_string *name = READ_STRING(READ_VARIABLE_CONST());
+                    long slot = -1;
+                    if (!record_field(vm, record, name, &slot)) return INTERPRET_RUNTIME_ERROR;
+                    if (slot == -1) continue;
+                    vm->stack_ptr[-1] = record->fields[slot];
+                    break;
+                }
+                if (IS_BUILDER(obj)) {
+                    object_string *name = READ_STRING(READ_VARIABLE_CONST());
+                    bound_native_function fn = NULL;
+                    if (name == vm->append_string) fn = builder_append_native;
+                    else if (name == vm->build_string) fn = builder_build_native;
+                    if (fn == NULL) {
+                        if (!runtime_error(vm, NAME_ERROR, "String builders do not have property '%s'.", name->chars)) return INTERPRET_RUNTIME_ERROR;
+                        continue;
+                    }
+                    object_bound_native *bound = new_bound_native(vm, peek(vm, 0), fn);
+                    pop(vm);
+                    push(vm, OBJ_VAL(bound));
+                    break;
+                }
                 if (!(IS_INSTANCE(obj) || IS_NAMESPACE(obj) || IS_EXCEPTION(obj) || IS_ARRAY(obj))) {
                     if(!runtime_error(vm, TYPE_ERROR, "Only instances, namespaces, exceptions and arrays have properties.")) return INTERPRET_RUNTIME_ERROR;
                     continue;
@@ -1177,7 +1557,8 @@ static interpret_result run(VM *vm) {
                         push(vm, v);
                         break;
                     }
-                    if (!bind_method(vm, instance->class_, name, 1)){
+                    if (!bind_method(vm, instance->class_, name, 0)){
+                        pop(vm);
                         push(vm, UNDEFINED_VAL); // Take JS approach of using undefined for non-existent properties
                         break;
                     }
@@ -1217,6 +1598,15 @@ static interpret_result run(VM *vm) {
             }
             case OP_GET_PROPERTY_KEEP_REF: {
                 value obj = peek(vm, 0);
+                if (IS_RECORD(obj)) {
+                    object_record *record = AS_RECORD(obj);
+                    object_string *name = READ_STRING(READ_VARIABLE_CONST());
+                    long slot = -1;
+                    if (!record_field(vm, record, name, &slot)) return INTERPRET_RUNTIME_ERROR;
+                    if (slot == -1) continue;
+                    push(vm, record->fields[slot]);
+                    break;
+                }
                 if (!(IS_INSTANCE(obj) || IS_NAMESPACE(obj) || IS_EXCEPTION(obj))) {
                     if(!runtime_error(vm, TYPE_ERROR, "Only instances, namespaces and exceptions have properties.")) return INTERPRET_RUNTIME_ERROR;
                     continue;
@@ -1265,8 +1655,36 @@ static interpret_result run(VM *vm) {
 
                 break;
             }
+            case OP_SET_FIELD: {
+                uint8_t slot = READ_BYTE();
+                if (IS_RECORD(peek(vm, 1))) {
+                    object_record *record = AS_RECORD(peek(vm, 1));
+                    object_string *name = READ_STRING(READ_VARIABLE_CONST());
+                    long index = slot;
+                    if (!record_field(vm, record, name, &index)) return INTERPRET_RUNTIME_ERROR;
+                    if (index == -1) continue;
+                    record->fields[index] = peek(vm, 0);
+                    write_barrier(vm, (object*) record, peek(vm, 0));
+                    value v = pop(vm);
+                    vm->stack_ptr[-1] = v;
+                    break;
+                }
+            }
+            // fall through
             case OP_SET_PROPERTY: {
                 value obj = peek(vm, 1);
+                if (IS_RECORD(obj)) {
+                    object_record *record = AS_RECORD(obj);
+                    object_string *name = READ_STRING(READ_VARIABLE_CONST());
+                    long slot = -1;
+                    if (!record_field(vm, record, name, &slot)) return INTERPRET_RUNTIME_ERROR;
+                    if (slot == -1) continue;
+                    record->fields[slot] = peek(vm, 0);
+                    write_barrier(vm, (object*) record, peek(vm, 0));
+                    value v = pop(vm);
+                    vm->stack_ptr[-1] = v;
+                    break;
+                }
                 if (IS_EXCEPTION(obj)) {
                     if(!runtime_error(vm, TYPE_ERROR, "Properties of exceptions cannot be set.")) return INTERPRET_RUNTIME_ERROR;
                     continue;
@@ -1279,6 +1697,7 @@ static interpret_result run(VM *vm) {
                 if (IS_INSTANCE(obj)) h = &AS_INSTANCE(obj)->fields;
                 else if (IS_NAMESPACE(obj)) h = &AS_NAMESPACE(obj)->values;
                 hashmap_set(h, vm, READ_STRING(READ_VARIABLE_CONST()), peek(vm, 0));
+                write_barrier(vm, AS_OBJ(obj), peek(vm, 0));
                 value v = pop(vm);
                 pop(vm);
                 push(vm, v);
@@ -1291,7 +1710,12 @@ static interpret_result run(VM *vm) {
             case OP_INVOKE: {
                 object_string *method = READ_STRING(READ_VARIABLE_CONST());
                 uint8_t argc = READ_BYTE();
-                if (!invoke(vm, method, argc)) {
+                uint8_t *cache = vm->active_frame->ip; // Inline cache after the operands, for calls on instances
+                vm->active_frame->ip += 7;
+                uint8_t wanted = READ_BYTE();
+                uint32_t depth = vm->frame_count;
+                uint8_t *resume = vm->active_frame->ip;
+                if (!invoke(vm, method, argc, cache) || !expect_values(vm, depth, resume, wanted)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 vm->active_frame = &vm->frames[vm->frame_count - 1];
@@ -1300,21 +1724,45 @@ static interpret_result run(VM *vm) {
             case OP_GET_SUPER: {
                 object_string *name = READ_STRING(READ_VARIABLE_CONST());
                 object_class *superclass = AS_CLASS(pop(vm));
-                if (!bind_method(vm, superclass, name, 0)) {
-                    return INTERPRET_RUNTIME_ERROR;
+                object_closure *method = resolve_super(vm, superclass, name);
+                if (method == NULL) {
+                    if (!runtime_error(vm, NAME_ERROR, "Undefined property '%s'.", name->chars)) return INTERPRET_RUNTIME_ERROR;
+                    continue;
                 }
+                object_bound_method *bound = new_bound_method(vm, peek(vm, 0), method);
+                pop(vm);
+                push(vm, OBJ_VAL(bound));
                 break;
             }
             case OP_INVOKE_SUPER: {
-                object_string *method = READ_STRING(READ_VARIABLE_CONST());
+                object_string *name = READ_STRING(READ_VARIABLE_CONST());
                 uint8_t argc = READ_BYTE();
                 object_class *superclass = AS_CLASS(pop(vm));
-                if (!invoke_from_class(vm, superclass, method, argc)) {
+                object_closure *method = resolve_super(vm, superclass, name);
+                uint8_t wanted = READ_BYTE();
+                if (method == NULL) {
+                    if (!runtime_error(vm, NAME_ERROR, "Undefined property '%s'.", name->chars)) return INTERPRET_RUNTIME_ERROR;
+                    continue;
+                }
+                uint32_t depth = vm->frame_count;
+                uint8_t *resume = vm->active_frame->ip;
+                if (!call(vm, method, argc) || !expect_values(vm, depth, resume, wanted)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 vm->active_frame = &vm->frames[vm->frame_count-1];
                 break;
             }
+            case OP_SWITCH: {
+                if (IS_STRING(peek(vm, 0))) flatten_string(vm, AS_STRING(peek(vm, 0))); // String cases are found by hash
+                segment *seg = &vm->active_frame->closure->function->seg;
+                switch_table *t = &seg->switches[READ_UINT24()];
+                vm->active_frame->ip = seg->bytecode + switch_target(t, pop(vm));
+                break;
+            }
+            case OP_SEAL_CLASS: {
+                seal_class(vm, AS_CLASS(pop(vm)));
+                break;
+            }
             case OP_REGISTER_CATCH: {
                 uint8_t had_error = 0;
                 uint8_t num_errors = READ_BYTE();
@@ -1334,6 +1782,7 @@ static interpret_result run(VM *vm) {
                 catcher->frame_at_try = vm->frame_count;
                 catcher->num_errors = num_errors;
                 catcher->stack_size_at_try = STACK_LEN(vm);
+                catcher->scratch_count_at_try = vm->scratch_count;
                 catcher->next = vm->catch_stack;
                 vm->catch_stack = catcher;
                 break;
@@ -1355,6 +1804,36 @@ static interpret_result run(VM *vm) {
     #undef READ_VARIABLE_CONST
 }
 
+static uint8_t stack_overflow_error(VM *vm) {
+    lend_guard_page(&vm->stack_region); // The exception is built on top of the full stack
+    uint8_t handled = runtime_error(vm, RECURSION_ERROR, "Stack overflow (more than %zu values).", vm->stack_region.reserved / sizeof(value));
+    if (handled && (char*) (vm->stack_ptr + 1) <= vm->stack_region.base + vm->stack_region.reserved) restore_guard_page(&vm->stack_region);
+    return handled;
+}
+
+static interpret_result run_guarded(VM *vm) {
+    // Only pushes onto the value stack can fault. Those happen in run() itself and the helpers it calls to carry out an
+    // instruction, always once anything they've allocated is fully built, so the heap is never left half-updated by the
+    // jump. Natives and the allocation helpers in object.c keep their temporaries alive with push_root instead, and
+    // must never push onto the value stack. The root count and GC switch are restored regardless, and a pending OP_LONG
+    // prefix is cleared so that it can't widen the operand of the handler's first instruction.
+    // Frames, the stack pointer and scratch objects are unwound by raising the error, as for any other exception. The
+    // compiler never touches the value stack, so an import can't be interrupted part way through compiling.
+    size_t root_count = vm->root_count;
+    uint8_t gc_allowed = vm->gc_allowed;
+    while (setjmp(vm->stack_region.overflow)) { // Landed here from the fault handler - whatever was running is abandoned
+        vm->stack_region.guarded = 0;
+        vm->root_count = root_count;
+        vm->gc_allowed = gc_allowed;
+        vm->long_instruction = 0;
+        if (!stack_overflow_error(vm)) return INTERPRET_RUNTIME_ERROR;
+    }
+    vm->stack_region.guarded = 1;
+    interpret_result result = run(vm);
+    vm->stack_region.guarded = 0;
+    return result;
+}
+
 interpret_result interpret(VM *vm, const char *source) {
     object_function *function = compile(source, vm);
     if (function == NULL) return INTERPRET_COMPILE_ERROR;
@@ -1365,5 +1844,5 @@ interpret_result interpret(VM *vm, const char *source) {
     push(vm, OBJ_VAL(closure));
     call(vm, closure, 0);
 
-    return run(vm);
+    return run_guarded(vm);
 }
\ No newline at end of file
@@ -4,37 +4,96 @@
 
 #include "segment.h"
 #include "hashmap.h"
+#include "heap.h"
+#include "stack.h"
 
-#define STACK_INITIAL 64
-#define FRAMES_MAX 1024
-#define GC_THRESHOLD_INITIAL 512 * 1024
+#define FRAMES_MAX_DEFAULT 1024 // Default call depth, past which calls raise a RecursionError
+#define SMALL_INT_STRINGS 1024 // Integers from 0 up to this have their string forms cached
+#define STACK_SIZE_DEFAULT (8 * 1024 * 1024) // Bytes reserved for the value stack - it never moves, and the page after it is a guard
+#define GC_THRESHOLD_INITIAL 512 * 1024 // Default heap size for the first major collection, and the floor for later ones
+#define GC_NURSERY_SIZE 256 * 1024 // Default bytes allocated between minor collections
+#define GC_HEAP_GROW_FACTOR 2 // Default heap growth over the survivors of a major collection
+#define GC_TARGET_PERCENT_DEFAULT 5 // Share of run time the adaptive pacer aims to spend collecting
+#define GC_ADAPTIVE_MAX_GROWTH 8 // The adaptive pacer never gives the heap more headroom than this many times what survived
+#define GC_MAX_MINOR_COLLECTIONS 32 // Old garbage only goes away in a major collection, so force one every so often
+#define GC_STEP_SIZE 64 * 1024 // Bytes allocated between incremental marking steps
+#define GC_STEP_CHUNK 32 // Objects traced between checks of the step budget
+#ifdef DEBUG_STRESS_GC
+    #define GC_STEP_MIN_WORK GC_STEP_CHUNK // Steps happen on every allocation, so keep them tiny to interleave as much as possible
+#else
+    #define GC_STEP_MIN_WORK 2048 // Objects traced per step regardless of budget, so marking outpaces allocation
+#endif
+#define GC_THREADS_MAX 64
+#define GC_LAZY_SWEEP_PAGES 16 // Pending pages each minor collection sweeps on top of the young objects
+#define GC_STEP_BUDGET_DEFAULT 1000000 // Nanoseconds of marking per step once the minimum work is done
+
+#define PENDING_COMPACTION 0x1 // A major collection finished and the heap should be compacted
+#define PENDING_MEMORY_ERROR 0x2 // The heap limit was exceeded even after a full collection
 
 typedef struct exception_catch {
     size_t catch_address;
     size_t stack_size_at_try;
-    uint16_t frame_at_try;
+    uint32_t frame_at_try;
+    size_t scratch_count_at_try;
     value catching_errors[256];
     uint8_t num_errors;
     struct exception_catch *next;
 } exception_catch;
 
+typedef enum {
+    GC_IDLE,
+    GC_MARKING, // Incremental major collection in progress
+    GC_REMARK, // Final atomic rescan of the roots
+} gc_phase;
+
+typedef struct {
+    size_t initial_threshold; // Heap size that triggers the first major collection
+    double growth_factor; // Next major collection once the heap is this many times what survived the last
+    size_t min_heap; // Never schedule a major collection below this
+    size_t max_heap; // Never schedule one above this, 0 for no cap (a pacing bound, unlike the hard heap_limit)
+    size_t nursery_size; // Bytes allocated between minor collections
+    uint8_t adaptive; // Size the next major collection from measured behaviour rather than growth_factor
+    double target_percent; // Adaptive only - share of run time to spend in the GC
+} gc_config;
+
+typedef struct { // What the adaptive pacer measures over each major cycle
+    uint64_t start_ns;
+    uint64_t pause_ns; // Time spent collecting (minor and major) during the cycle
+    size_t start_bytes;
+    size_t start_freed;
+    size_t survivors; // Survivors of the major collection that started the cycle
+} gc_cycle;
+
+typedef struct {
+    uint64_t minor_collections;
+    uint64_t major_collections;
+    uint64_t mark_steps;
+    uint64_t total_pause_ns;
+    uint64_t max_pause_ns;
+    size_t bytes_freed;
+    uint64_t pages_compacted;
+} gc_statistics;
+
 typedef struct {
     object_closure *closure;
     uint8_t *ip;
     value *slots;
-    size_t slot_offset;
     uint8_t is_module_frame;
     char *saved_source_path;
+    size_t scratch_base; // Number of frame-local objects that existed when the frame was entered
+    uint8_t wanted; // Values the caller takes from this call, a count or RETURNS_ANY
 } call_frame;
 
 typedef struct VM {
     char *source_path;
-    call_frame frames[FRAMES_MAX];
-    uint16_t frame_count;
+    call_frame *frames; // Grown as calls nest, so moves - frames are referred to by index across calls
+    uint32_t frame_count;
+    uint32_t frame_capacity;
+    uint32_t max_depth;
     call_frame *active_frame;
     value *stack;
-    size_t stack_capacity;
     value *stack_ptr;
+    stack_region stack_region; // The reservation the stack lives in, guarded while run() is under way
     hashmap strings;
     hashmap globals;
     object_string *init_string;
@@ -50,9 +109,13 @@ typedef struct VM {
     object_string *push_string;
     object_string *pop_string;
     object_string *contains_string;
+    object_string *append_string;
+    object_string *build_string;
     object_string *len_string;
     object_string *message_string;
     object_string *type_string;
+    object_string *char_strings[256]; // Every single-byte string, made up front so indexing a string never allocates
+    object_string *int_strings[SMALL_INT_STRINGS]; // Made the first time each integer is converted
     uint8_t owns_strings; // Secondary VMs don't own their strings table so have to leave it free
     uint8_t long_instruction;
     uint8_t gc_allowed;
@@ -61,10 +124,28 @@ typedef struct VM {
     object **grey_stack;
     size_t bytes_allocated;
     size_t gc_threshold;
+    size_t major_threshold;
+    uint32_t minors_since_major;
+    gc_phase gc_phase;
+    uint64_t gc_step_budget; // Nanoseconds an incremental marking step may run for
+    gc_statistics gc_stats;
+    uint32_t gc_threads; // Marking threads, including the one running the program
+    struct marker_pool *markers;
+    gc_config gc_config;
+    gc_cycle gc_cycle;
+    uint8_t gc_compact; // Evacuate sparse pages after each major collection
+    uint8_t pending_work; // PENDING_* work that has to wait for the interpreter's next safe point
+    size_t heap_limit; // Bytes the heap may grow to before a MemoryError, 0 for no limit
     object_upvalue *open_upvalues;
     object_exception *exception_stack;
     exception_catch *catch_stack;
-    object *objects;
+    heap heap;
+    value **roots; // Locals of running C code that the GC has to treat as roots, see push_root
+    size_t root_count;
+    size_t root_capacity;
+    object **scratch; // Frame-local objects (non-escaping arrays and closures), released in LIFO order
+    size_t scratch_count;
+    size_t scratch_capacity;
 } VM;
 
 #define STACK_LEN(vm) (vm->stack_ptr - vm->stack)
@@ -82,12 +163,18 @@ void push(VM *vm, value val);
 value pop(VM *vm);
 value popn(VM *vm, size_t n);
 void define_native(VM *vm, const char *name, value (*function)(VM *vm, uint8_t argc, value *argv) );
+void define_gc_safe_native(VM *vm, const char *name, value (*function)(VM *vm, uint8_t argc, value *argv));
 uint8_t runtime_error(VM *vm, error_type type, const char *format, ...);
 uint8_t is_falsey(value v);
 void enable_gc(VM *vm);
 void disable_gc(VM *vm);
-void resize_stack(VM *vm, size_t target_size);
+void release_stack(VM *vm);
+void set_max_depth(VM *vm, uint32_t depth);
+void set_stack_size(VM *vm, size_t bytes);
 void define_native_global(VM *vm, const char *name, value val);
+void set_heap_limit(VM *vm, size_t bytes);
+void set_gc_config(VM *vm, const gc_config *config);
+void enable_arena(VM *vm, size_t cap);
 uint8_t raise(VM *vm, object_exception *exception);
 
 #endif
\ No newline at end of file
@@ -150,4 +150,42 @@ def test_array_method_first_class():
     lines = completed.stdout.split("\n")
     assert len(lines) == 2
     assert lines[0] == "[1, 2, 3]"
-    assert lines[1] == ""
\ No newline at end of file
+    assert lines[1] == ""
+
+def test_array_frame_local():
+    completed = subprocess.run(["bin/canidae", "test/arrays/array_frame_local.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 5
+    assert lines[0] == "75"
+    assert lines[1] == "[[0], [1], [2]]"
+    assert lines[2] == "24"
+    assert lines[3] == "4"
+    assert lines[4] == ""
+
+def test_array_to_string():
+    completed = subprocess.run(["bin/canidae", "test/arrays/array_to_string.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 6
+    assert lines[0] == "[]"
+    assert lines[1] == "[[], [1]]"
+    assert lines[2] == "[row, 2999, [5998]]"
+    assert lines[3] == "true"
+    assert lines[4] == "true"
+    assert lines[5] == ""
+
+def test_array_print_nested():
+    completed = subprocess.run(["bin/canidae", "test/arrays/array_print_nested.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 9
+    assert lines[0] == "[4999, r, [9998, null]]"
+    assert lines[1] == "[[[]], [true, [undefined]], 1.5, s]"
+    assert lines[2] == "(1, 2)"
+    assert lines[3] == "(3, 4)"
+    assert lines[4] == "[1, [2, x]] [1, r, [2, null]]"
+    assert lines[5] == "123335"
+    assert lines[6] == "true"
+    assert lines[7] == "[" + ", ".join("[%d, r, [%d, null]]" % (i, i * 2) for i in range(5000)) + "]"
+    assert lines[8] == ""
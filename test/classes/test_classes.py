@@ -92,4 +92,171 @@ def test_overloading():
     assert lines[2] == "(4, 6)"
     assert lines[3] == "11"
     assert lines[4] == "5"
-    
\ No newline at end of file
+    
+def test_property_stack():
+    completed = subprocess.run(["bin/canidae",  "test/classes/property_stack.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 5
+    assert lines[0] == "undefined"
+    assert lines[1] == "3"
+    assert lines[2] == "3"
+    assert lines[3] == "[undefined, 4, 4]"
+    assert lines[4] == ""
+
+def test_vtable():
+    completed = subprocess.run(["bin/canidae",  "test/classes/vtable.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 13
+    assert lines[0] == "C(B(A)) 3"
+    assert lines[1] == "extra"
+    assert lines[2] == "A 1"
+    assert lines[3] == "child of A 0"
+    assert lines[4] == "child of B(A) 1"
+    assert lines[5] == "D C(B(A))"
+    assert lines[6] == "extra own"
+    assert lines[7] == "C(B(A)) 5"
+    assert lines[8] == "A"
+    assert lines[9] == "C(B(A))"
+    assert lines[10] == "C(B(A))"
+    assert lines[11] == "A"
+    assert lines[12] == ""
+
+def test_structs():
+    completed = subprocess.run(["bin/canidae",  "test/classes/structs.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 13
+    assert lines[0] == "1"
+    assert lines[1] == "2"
+    assert lines[2] == "18"
+    assert lines[3] == "4"
+    assert lines[4] == "7"
+    assert lines[5] == "<struct Point>"
+    assert lines[6] == "true"
+    assert lines[7] == "5"
+    assert lines[8] == "42"
+    assert lines[9] == "Struct 'Point' has no field 'z'."
+    assert lines[10] == "Expected 2 arguments (got 1)."
+    assert lines[11] == "9"
+    assert lines[12] == ""
+
+def test_struct_duplicate_field():
+    completed = subprocess.run(["bin/canidae",  "test/classes/struct_duplicate_field.can"], text=True, capture_output=True)
+    assert completed.returncode == 65
+    lines = completed.stderr.split("\n")
+    assert len(lines) == 2
+    assert lines[0].startswith("[line 1] Error at 'x':")
+    assert lines[1] == ""
+
+def test_struct_too_many_fields():
+    completed = subprocess.run(["bin/canidae",  "test/classes/struct_too_many_fields.can"], text=True, capture_output=True)
+    assert completed.returncode == 65
+    lines = completed.stderr.split("\n")
+    assert len(lines) == 2
+    assert lines[0] == "[line 1] Error at 'f255': Can't have more than 255 fields in a struct."
+    assert lines[1] == ""
+
+def test_struct_churn():
+    completed = subprocess.run(["bin/canidae",  "test/classes/struct_churn.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 5
+    assert lines[0] == "20"
+    assert lines[1] == "3000"
+    assert lines[2] == "19000"
+    assert lines[3] == "190000"
+    assert lines[4] == ""
+
+def test_old_to_young():
+    completed = subprocess.run(["bin/canidae",  "test/classes/old_to_young.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 7
+    assert lines[0] == "a25000"
+    assert lines[1] == "b25000"
+    assert lines[2] == "c25000"
+    assert lines[3] == "d25000"
+    assert lines[4] == "6"
+    assert lines[5] == "e25000"
+    assert lines[6] == ""
+
+def test_incremental_gc():
+    completed = subprocess.run(["bin/canidae", "--gc-budget", "0", "--gc-stats", "test/classes/incremental_gc.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 6
+    assert lines[0] == "1.9997e+08"
+    assert lines[1] == "n39999"
+    assert lines[2] == "n39942"
+    assert lines[3] == "true"
+    assert lines[4] == "true"
+    assert lines[5] == ""
+    assert completed.stderr.startswith("[gc] ")
+
+def test_parallel_marking():
+    completed = subprocess.run(["bin/canidae", "--gc-threads", "4", "--gc-budget", "0", "test/classes/incremental_gc.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 6
+    assert lines[0] == "1.9997e+08"
+    assert lines[1] == "n39999"
+    assert lines[2] == "n39942"
+    assert lines[3] == "true"
+    assert lines[4] == "true"
+    assert lines[5] == ""
+
+def test_compaction():
+    completed = subprocess.run(["bin/canidae", "--compact", "test/classes/compaction.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 7
+    assert lines[0] == "180600"
+    assert lines[1] == "p10"
+    assert lines[2] == "ten"
+    assert lines[3] == "twenty"
+    assert lines[4] == "5902"
+    assert lines[5] == "true"
+    assert lines[6] == ""
+
+def test_gc_pacing():
+    completed = subprocess.run(["bin/canidae", "--gc-adaptive", "5", "--gc-min-heap", "4M", "--gc-max-heap", "8M", "test/classes/gc_pacing.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 6
+    assert lines[0] == "20000"
+    assert lines[1] == "199999"
+    assert lines[2] == "true"
+    assert lines[3] == "true"
+    assert lines[4] == "true"
+    assert lines[5] == ""
+
+def test_gc_pacing_bad_growth():
+    completed = subprocess.run(["bin/canidae", "--gc-growth", "1", "test/classes/gc_pacing.can"], text=True, capture_output=True)
+    assert completed.returncode == 64
+    assert completed.stderr.startswith("Usage: canidae")
+
+def test_arena():
+    completed = subprocess.run(["bin/canidae", "--arena", "test/classes/arena.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 6
+    assert lines[0] == "1.9998e+08"
+    assert lines[1] == "row 39996"
+    assert lines[2] == "row 39999"
+    assert lines[3] == "true"
+    assert lines[4] == "true"
+    assert lines[5] == ""
+
+def test_arena_cap():
+    completed = subprocess.run(["bin/canidae", "--arena-cap", "1M", "test/classes/arena.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 6
+    assert lines[0] == "1.9998e+08"
+    assert lines[1] == "row 39996"
+    assert lines[2] == "row 39999"
+    assert lines[3] == "true"
+    assert lines[4] == "false"
+    assert lines[5] == ""
@@ -1,3 +1,4 @@
+import os
 import subprocess
 
 def test_trycatch_basic():
@@ -79,4 +80,46 @@ def test_raise_fancy():
     lines = completed.stdout.split("\n")
     assert len(lines) == 3
     assert lines[0] == "ruh roh"
-    assert "<exception TypeError" in lines[1]
\ No newline at end of file
+    assert "<exception TypeError" in lines[1]
+
+def test_heap_limit():
+    completed = subprocess.run(["bin/canidae", "--heap-limit", "8M", "test/exceptions/heap_limit.can"], text=True, capture_output=True)
+    assert completed.returncode == 70
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 6
+    assert lines[0] == "Heap limit of 8388608 bytes exceeded."
+    assert lines[1] == "Heap limit of 8388608 bytes exceeded."
+    assert lines[2] == "Heap limit of 8388608 bytes exceeded."
+    assert lines[3] == "3"
+    assert lines[4] == "1000"
+    assert lines[5] == ""
+    assert completed.stderr.startswith("[MemoryError] Heap limit of 8388608 bytes exceeded.")
+
+def test_heap_limit_environment():
+    completed = subprocess.run(["bin/canidae", "test/exceptions/heap_limit.can"], text=True, capture_output=True, env={**os.environ, "CANIDAE_HEAP_LIMIT": "4m"})
+    assert completed.returncode == 70
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 6
+    assert lines[0] == "Heap limit of 4194304 bytes exceeded."
+    assert lines[3] == "3"
+
+def test_stack_overflow():
+    completed = subprocess.run(["bin/canidae", "test/exceptions/stack_overflow.can"], text=True, capture_output=True)
+    assert completed.returncode == 70
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 4
+    assert lines[0] == "caught"
+    assert lines[1] == "caught"
+    assert lines[2] == "1"
+    assert lines[3] == ""
+    assert completed.stderr.startswith("[RecursionError] Stack overflow (more than 524288 values).")
+
+def test_stack_overflow_allocating():
+    completed = subprocess.run(["bin/canidae", "--stack-size", "64K", "test/exceptions/stack_overflow_allocating.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 4
+    assert lines[0] == "64"
+    assert lines[1] == "still allocating"
+    assert lines[2] == "<exception TypeError 'fine'>"
+    assert lines[3] == ""
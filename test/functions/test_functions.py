@@ -79,4 +79,87 @@ def test_closure_closed_shared():
     assert lines[0] == "Hello, World!"
     assert lines[1] == "Assignment is behaving as you'd expect."
     assert lines[2] == "Goodbye, World!"
-    assert lines[3] == ""
\ No newline at end of file
+    assert lines[3] == ""
+
+def test_closure_frame_local():
+    completed = subprocess.run(["bin/canidae", "test/functions/closure_frame_local.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 4
+    assert lines[0] == "30"
+    assert lines[1] == "10"
+    assert lines[2] == "3"
+    assert lines[3] == ""
+
+def test_multiple_return():
+    completed = subprocess.run(["bin/canidae", "test/functions/multiple_return.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 20
+    assert lines[0] == "3"
+    assert lines[1] == "2"
+    assert lines[2] == "6"
+    assert lines[3] == "3"
+    assert lines[4] == "1"
+    assert lines[5] == "lr"
+    assert lines[6] == "rl"
+    assert lines[7] == "123"
+    assert lines[8] == "6"
+    assert lines[9] == "xy"
+    assert lines[10] == "7"
+    assert lines[11] == "Expected 2 values (got 3)."
+    assert lines[12] == "Expected 4 values (got 3)."
+    assert lines[13] == "Expected 1 value (got 3)."
+    assert lines[14] == "Expected 2 values (got 3)."
+    assert lines[15] == "Expected 1 value (got 3)."
+    assert lines[16] == "Expected 2 values (got 1)."
+    assert lines[17] == "Expected 2 values (got 1)."
+    assert lines[18] == "Expected 2 values (got 1)."
+    assert lines[19] == ""
+
+def test_multiple_return_not_call():
+    completed = subprocess.run(["bin/canidae", "test/functions/multiple_return_not_call.can"], text=True, capture_output=True)
+    assert completed.returncode == 65
+    lines = completed.stderr.split("\n")
+    assert len(lines) == 4
+    assert lines[0] == "[line 4] Error at '4': Can only unpack the values returned by a call."
+    assert lines[1] == "[line 5] Error at '5': Can only unpack the values returned by a call."
+    assert lines[2] == "[line 6] Error at ']': Can only unpack the values returned by a call."
+    assert lines[3] == ""
+
+def test_deep_recursion():
+    completed = subprocess.run(["bin/canidae", "test/functions/deep_recursion.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 5
+    assert lines[0] == "1000"
+    assert lines[1] == "Exceeded max call depth (1024)."
+    assert lines[2] == "Exceeded max call depth (1024)."
+    assert lines[3] == "10"
+    assert lines[4] == ""
+
+def test_deep_recursion_max_depth():
+    completed = subprocess.run(["bin/canidae", "--max-depth", "100000", "test/functions/deep_recursion.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 5
+    assert lines[0] == "1000"
+    assert lines[1] == "50000"
+    assert lines[2] == "50000"
+    assert lines[3] == "10"
+    assert lines[4] == ""
+
+def test_max_depth_wide_literal():
+    completed = subprocess.run(["bin/canidae", "--max-depth", "4", "test/functions/wide_literal.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 3
+    assert lines[0] == "5000"
+    assert lines[1] == "4999"
+    assert lines[2] == ""
+
+def test_stack_size():
+    completed = subprocess.run(["bin/canidae", "--stack-size", "64K", "test/functions/wide_literal.can"], text=True, capture_output=True)
+    assert completed.returncode == 70
+    assert completed.stdout == ""
+    assert completed.stderr.startswith("[RecursionError] Stack overflow (more than 4096 values).")
@@ -132,4 +132,77 @@ def test_coalesce_assignment():
     assert lines[1] == "original"  # "original" ??= "not assigned"
     assert lines[2] == "42"        # undefined ??= 42
     assert lines[3] == ""
-    
\ No newline at end of file
+    
+
+def test_switch():
+    completed = subprocess.run(["bin/canidae", "test/logic/switch.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 42
+    assert lines[0] == "one"
+    assert lines[1] == "two or three"
+    assert lines[2] == "other"
+    assert lines[3] == "five"
+    assert lines[4] == "other"
+    assert lines[5] == "other"
+    assert lines[6] == "low"
+    assert lines[7] == "half"
+    assert lines[8] == "high"
+    assert lines[9] == "none"
+    assert lines[10] == "writing"
+    assert lines[11] == "removing"
+    assert lines[12] == "unknown"
+    assert lines[13] == "string"
+    assert lines[14] == "bool"
+    assert lines[15] == "null"
+    assert lines[16] == "other"
+    assert lines[17] == "2"
+    assert lines[18] == "4"
+    assert lines[19] == "6"
+    assert lines[20] == "type"
+    assert lines[21] == "nan"
+    assert lines[22] == "other"
+    assert lines[23] == "other"
+    assert lines[24] == "other"
+    assert lines[25] == "other"
+    assert lines[26] == "other"
+    assert lines[27] == "none"
+    assert lines[28] == "none"
+    assert lines[29] == "none"
+    assert lines[30] == "none"
+    assert lines[31] == "long"
+    assert lines[32] == "unknown"
+    assert lines[33] == "unknown"
+    assert lines[34] == "number"
+    assert lines[35] == "other"
+    assert lines[36] == "other"
+    assert lines[37] == "other"
+    assert lines[38] == "index"
+    assert lines[39] == "other"
+    assert lines[40] == "other"
+    assert lines[41] == ""
+
+def test_switch_tables():
+    completed = subprocess.run(["bin/canidae_debug", "test/logic/switch_tables.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    kinds = [line.split("(")[1].split(",")[0] for line in completed.stdout.split("\n") if "OP_SWITCH" in line]
+    assert len(kinds) == 11
+    assert kinds[0] == "dense"
+    assert kinds[1] == "dense"
+    assert kinds[2] == "sparse"
+    assert kinds[3] == "sparse"
+    assert kinds[4] == "sparse"
+    assert kinds[5] == "string"
+    assert kinds[6] == "error"
+    assert kinds[7] == "generic"
+    assert kinds[8] == "generic"
+    assert kinds[9] == "generic"
+    assert kinds[10] == "sparse"
+
+def test_switch_duplicate_case():
+    completed = subprocess.run(["bin/canidae", "test/logic/switch_duplicate_case.can"], text=True, capture_output=True)
+    assert completed.returncode == 65
+    lines = completed.stderr.split("\n")
+    assert len(lines) == 2
+    assert lines[0].startswith("[line 3] Error at '1':")
+    assert lines[1] == ""
@@ -156,4 +156,109 @@ def string_comparison():
     assert lines[21] == "false"
     assert lines[22] == "true"
     assert lines[23] == "false"
-    assert lines[24] == ""
\ No newline at end of file
+    assert lines[24] == ""
+
+def test_string_rope():
+    completed = subprocess.run(["bin/canidae", "test/strings/string_rope.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 13
+    assert lines[0] == "150"
+    assert lines[1] == "true"
+    assert lines[2] == "true"
+    assert lines[3] == "false"
+    assert lines[4] == "true"
+    assert lines[5] == "true"
+    assert lines[6] == "matched"
+    assert lines[7] == "a"
+    assert lines[8] == "a" * 150 + "!"
+    assert lines[9] == "153"
+    assert lines[10] == "9000"
+    assert lines[11] == "z"
+    assert lines[12] == ""
+
+def test_string_uninterned():
+    completed = subprocess.run(["bin/canidae", "test/strings/string_uninterned.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 10
+    assert lines[0] == "390"
+    assert lines[1] == "true"
+    assert lines[2] == "false"
+    assert lines[3] == "false"
+    assert lines[4] == "true"
+    assert lines[5] == "long match"
+    assert lines[6] == "default"
+    assert lines[7] == "true"
+    assert lines[8] == "matched"
+    assert lines[9] == ""
+
+def test_string_inline():
+    completed = subprocess.run(["bin/canidae", "test/strings/string_inline.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 6
+    assert lines[0] == "8"
+    assert lines[1] == "990"
+    assert lines[2] == "1011"
+    assert lines[3] == "]"
+    assert lines[4] == "1234!"
+    assert lines[5] == ""
+
+def test_string_small_cache():
+    completed = subprocess.run(["bin/canidae", "test/strings/string_small_cache.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 6
+    assert lines[0] == "ce"
+    assert lines[1] == "true"
+    assert lines[2] == "0-07102310242.5"
+    assert lines[3] == "true"
+    assert lines[4] == "true"
+    assert lines[5] == ""
+
+def test_string_slice():
+    completed = subprocess.run(["bin/canidae", "test/strings/string_slice.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 19
+    assert lines[0] == "field0,"
+    assert lines[1] == "d39"
+    assert lines[2] == "300"
+    assert lines[3] == "fd"
+    assert lines[4] == "150"
+    assert lines[5] == "true"
+    assert lines[6] == "14,fie|32,fie"
+    assert lines[7] == "true"
+    assert lines[8] == "true"
+    assert lines[9] == "matched"
+    assert lines[10] == "".join("field%d," % i for i in range(40))[7:307]
+    assert lines[11] == "Function 'slice' got a range outside the string (length 310)."
+    assert lines[12] == "Function 'substr' got a range outside the string (length 310)."
+    assert lines[13] == "Function 'slice' expects a string, a start index and an end index."
+    assert lines[14] == "Function 'slice' got a range outside the string (length 310)."
+    assert lines[15] == "Function 'substr' got a range outside the string (length 310)."
+    assert lines[16] == "bc"
+    assert lines[17] == "de"
+    assert lines[18] == ""
+
+def test_string_builder():
+    completed = subprocess.run(["bin/canidae", "test/strings/string_builder.can"], text=True, capture_output=True)
+    assert completed.returncode == 0
+    lines = completed.stdout.split("\n")
+    assert len(lines) == 15
+    assert lines[0] == "0,1,2,3,4,truenull[1, a]"
+    assert lines[1] == "0,1,2,3,4,truenull[1, a]!"
+    assert lines[2] == "<string builder>"
+    assert lines[3] == "188890"
+    assert lines[4] == "9"
+    assert lines[5] == "a, b, c"
+    assert lines[6] == "1-2.5-x-null"
+    assert lines[7] == "true"
+    assert lines[8] == "solo"
+    assert lines[9] == "1389"
+    assert lines[10] == "true"
+    assert lines[11] == "Function 'join' expects an array and a string separator."
+    assert lines[12] == "append() takes 1 argument (got 0)."
+    assert lines[13] == "String builders do not have method 'reverse'."
+    assert lines[14] == ""